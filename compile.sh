@@ -1,6 +1,6 @@
 #!/bin/bash
 
 
-LINK_FLAGS='-lSDL2 -lSDL2_image'
-DEFINE_FLAGS='-DDEBUG -DFAST_DDA'
-g++ -I./ $LINK_FLAGS main.cpp initSDL.cpp render.cpp -o main $DEFINE_FLAGS
+LINK_FLAGS='-lSDL2 -lSDL2_image -pthread'
+DEFINE_FLAGS='-DDEBUG -DFAST_DDA -DASSETS_PATH="../assets"'
+g++ -I./ main.cpp initSDL.cpp options.cpp render.cpp spans.cpp -o main $DEFINE_FLAGS $LINK_FLAGS
@@ -0,0 +1,330 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <initializer_list>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "initSDL.h"
+#include "render.h"
+#include "renderPool.h"
+#include "drawContext.h"
+#include "things.h"
+#include "miniMap.h"
+#include "scene.h"
+#include "camera.h"
+#include "tileMap.h"
+#include "spans.h"
+#include "profiler.h"
+#include "timer.h"
+#include "pi.h"
+
+
+#ifndef ASSETS_PATH
+#define ASSETS_PATH "."
+#endif
+
+/* Renders scripted camera paths through the bench map headlessly, the
+ * same frames every run, and reports frames/s and the profile of each.
+ * Every frame is hashed and checked against the golden hashes, so a
+ * renderer change that alters a single pixel is caught. */
+#define BENCH_MAP     ASSETS_PATH"/maps/bench_map"
+#define BENCH_GOLDEN  ASSETS_PATH"/bench/golden.txt"
+#define BENCH_FRAMES  120
+#define BENCH_SPRITES 1000
+
+
+struct benchPose {
+    float x, y, a;
+};
+
+struct benchPath {
+    const char *name;
+    int         things; // coins scattered over the room
+    benchPose (*pose)(int frame, int frames);
+};
+
+/* The bench map is a 30x27 room over a corridor one cell wide along
+ * y = 2, see assets/maps/bench_map. */
+static const benchPath bench_paths[] = {
+    { "corridor", 0, [](int f, int n){
+        return benchPose{ 1.5f + 27.0f * f / n, 2.5f, 0.0f }; } },
+    { "room", 0, [](int f, int n){
+        return benchPose{ 15.5f, 17.5f, float(2*PI * f / n) }; } },
+    // A quarter of a cell from the wall, so it covers the whole screen.
+    { "wall", 0, [](int f, int n){
+        return benchPose{ 15.5f, 30.75f,
+                          float(PI/2 + 0.3 * std::sin(2*PI * f / n)) }; } },
+    { "sprites", BENCH_SPRITES, [](int f, int n){
+        return benchPose{ 15.5f, 17.5f, float(2*PI * f / n) }; } },
+};
+
+
+struct benchOptions {
+    int  frames  = BENCH_FRAMES;
+    int  threads = 1;
+    SPAN_ISA simd = SPAN_AUTO;
+    bool record  = false; // write the golden hashes instead of checking
+    const char *golden = BENCH_GOLDEN;
+};
+
+static bool
+parse_bench_options(int argc, char **argv, benchOptions &opts)
+{
+    for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if( 0 == std::strcmp(arg, "--frames") && i+1 < argc ) {
+            opts.frames = std::atoi(argv[++i]);
+            if(opts.frames < 1)
+                return false;
+        } else
+        if( 0 == std::strcmp(arg, "--threads") && i+1 < argc ) {
+            opts.threads = std::atoi(argv[++i]);
+        } else
+        if( 0 == std::strcmp(arg, "--simd") && i+1 < argc ) {
+            const char *isa = argv[++i];
+            if     ( 0 == std::strcmp(isa, "auto")   ) opts.simd = SPAN_AUTO;
+            else if( 0 == std::strcmp(isa, "scalar") ) opts.simd = SPAN_SCALAR;
+            else if( 0 == std::strcmp(isa, "sse2")   ) opts.simd = SPAN_SSE2;
+            else if( 0 == std::strcmp(isa, "avx2")   ) opts.simd = SPAN_AVX2;
+            else return false;
+        } else
+        if( 0 == std::strcmp(arg, "--record") ) {
+            opts.record = true;
+        } else
+        if( 0 == std::strcmp(arg, "--golden") && i+1 < argc ) {
+            opts.golden = argv[++i];
+        } else
+            return false;
+    }
+    return true;
+}
+
+/* FNV-1a of the frame. */
+static uint64_t
+hash_frame(const drawContext &dc)
+{
+    uint64_t h = 1469598103934665603ull;
+    const uint32_t *px = dc.pixels();
+    for(int i = 0; i < dc.SCREEN_WIDTH*dc.SCREEN_HEIGHT; ++i) {
+        h ^= px[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/* Golden hashes are "path frames frame hash" lines, poses depend on how
+ * many frames a path is split into. */
+using goldenSet = std::map<std::string, uint64_t>;
+
+static std::string
+golden_key(const char *path, int frames, int frame)
+{
+    return std::string(path) + " " + std::to_string(frames) + " " 
+         + std::to_string(frame);
+}
+
+static bool
+read_golden(const char *file, goldenSet &golden)
+{
+    std::ifstream in(file);
+    if(!in)
+        return false;
+    std::string path;
+    int frames, frame;
+    uint64_t h;
+    while(in >> path >> frames >> frame >> std::hex >> h >> std::dec)
+        golden[ golden_key(path.c_str(), frames, frame) ] = h;
+    return true;
+}
+
+/* Pixels of the frame sc is drawn into that keep what dc held before,
+ * none should, as frames are never cleared. The frame is drawn over two
+ * different fills and they are the pixels that differ. */
+static int
+unwritten_pixels(scene &sc, drawContext &dc, tileMap &tm, drawBuffers &db,
+                 renderPool *pool)
+{
+    static const uint32_t fills[2] = { 0x00000000, 0xFFFFFFFF };
+    size_t n = (size_t)dc.SCREEN_WIDTH * dc.SCREEN_HEIGHT;
+    std::vector<uint32_t> frame[2];
+    for(int k = 0; k < 2; ++k) {
+        std::vector<uint32_t> row(dc.SCREEN_WIDTH, fills[k]);
+        dc.lock();
+        for(int y = 0; y < dc.SCREEN_HEIGHT; ++y)
+            dc.copySpan(0, y, row.data(), dc.SCREEN_WIDTH);
+        dc.unlock();
+        draw(sc, dc, tm, db, pool);
+        frame[k].assign(dc.pixels(), dc.pixels() + n);
+    }
+    int unwritten = 0;
+    for(size_t i = 0; i < n; ++i)
+        unwritten += frame[0][i] != frame[1][i];
+    return unwritten;
+}
+
+/* The things of a path, coins scattered over the room the same way on
+ * every platform, so no distributions of <random>. */
+static void
+scatter_things(Things &things, int n, tileMap *coin)
+{
+    std::mt19937 rng(n);
+    things.reserve(n);
+    for(int i = 0; i < n; ++i) {
+        float x = 1.2f + (rng() % 2860) / 100.0f;
+        float y = 4.2f + (rng() % 2560) / 100.0f;
+        things.add(x, y, coin, 0);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    benchOptions opts{};
+    if( !parse_bench_options(argc, argv, opts) ) {
+        std::cout << "Usage: " << argv[0]
+                  << " [--frames N] [--threads N]"
+                  << " [--simd auto|scalar|sse2|avx2]"
+                  << " [--record] [--golden file]\n";
+        return OPTIONS_WRONG;
+    }
+    if( !select_span_kernels(opts.simd) ) {
+        std::cout << "This CPU cannot run the requested span kernels.\n";
+        return OPTIONS_WRONG;
+    }
+
+    err_code ret = initial_setup(true);
+    if(ret != NO_ERROR)
+        return ret;
+
+    INIT_DRAW_CONTEXT(dc, DC_CPU_FRAMEBUFFER,
+                      drawContext::DEFAULT_WIDTH, drawContext::DEFAULT_HEIGHT);
+    if( !dc.isValid() )
+        return dc.m_error;
+    // Odd heights split the rows between walls, floor and ceiling unevenly.
+    INIT_DRAW_CONTEXT(odd, DC_CPU_FRAMEBUFFER,
+                      drawContext::DEFAULT_WIDTH, drawContext::DEFAULT_HEIGHT/2 + 1);
+    if( !odd.isValid() )
+        return odd.m_error;
+
+    Map map(BENCH_MAP);
+    if( !map.isLoaded() )
+        return MAP_NOT_LOADED;
+
+    tileMap tm;
+    tm.load(ASSETS_PATH"/maps/test_map/pack2.png");
+    tileMap coin_txt{0x0000FF00};
+    coin_txt.load(ASSETS_PATH"/items/my_coin.png", 0, 0);
+    if( !tm.isLoaded() || !coin_txt.isLoaded() )
+        return TILEMAP_NOT_LOADED;
+
+    goldenSet golden;
+    bool checking = !opts.record && read_golden(opts.golden, golden);
+    std::ofstream record;
+    if(opts.record) {
+        record.open(opts.golden);
+        if(!record) {
+            std::cout << "Couldn't write " << opts.golden << ".\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<float[]> z_buffer( new float[dc.SCREEN_WIDTH] );
+    std::unique_ptr<int[]>   floor_h ( new int  [dc.SCREEN_WIDTH] );
+    renderPool pool{opts.threads};
+    miniMap    mm{map};
+    mm.m_rays = false; // frames are the same in every build
+    int        mismatches = 0, unchecked = 0, unwritten = 0;
+
+    std::cout << "Rendering " << opts.frames << " frames of "
+              << dc.SCREEN_WIDTH << "x" << dc.SCREEN_HEIGHT << " per path, "
+              << span_kernels().name << " span kernels.\n";
+    for(const benchPath &path : bench_paths) {
+        Thing    view(1.5, 1.5);
+        Things   things{};
+        thingGrid grid{map};
+        scatter_things(things, path.things, &coin_txt);
+        things.attach(grid);
+
+        camera      cam{ float(66 * PI / 180), dc.SCREEN_WIDTH };
+        depthOrder  order{};
+        std::vector<float> dst(things.slots() + 1);
+        scene       sc { map, view, things, grid, mm, cam, 1 };
+        drawBuffers db { z_buffer.get(), floor_h.get(), dst, order };
+
+        prof().reset();
+        timer  tmr{};
+        double took = 0;
+        for(int f = 0; f < opts.frames; ++f) {
+            benchPose ps = path.pose(f, opts.frames);
+            view.x = ps.x; view.y = ps.y; view.a = ps.a;
+
+            tmr.reset();
+            prof_ns t_frame = prof_now();
+            draw(sc, dc, tm, db, &pool);
+            prof().zone(PZ_FRAME, t_frame, prof_now());
+            prof().endFrame();
+            tmr.timeit();
+            took += tmr.getElapsedSC();
+
+            uint64_t h = hash_frame(dc);
+            if(opts.record)
+                record << path.name << " " << opts.frames << " " << f << " "
+                       << std::hex << std::setw(16) << std::setfill('0')
+                       << h << std::dec << "\n";
+            if(!checking)
+                continue;
+            auto g = golden.find( golden_key(path.name, opts.frames, f) );
+            if(g == golden.end()) {
+                ++unchecked;
+            } else
+            if(g->second != h) {
+                if(mismatches++ == 0)
+                    std::cout << "Frame " << f << " of " << path.name
+                              << " differs from the golden one.\n";
+            }
+        }
+
+        std::cout << "\n" << path.name << ": "
+                  << opts.frames / took << " frames/s\n";
+        prof().report(std::cout);
+
+        for(drawContext *c : { &dc, &odd }) {
+            for(int f = 0; f < opts.frames; ++f) {
+                benchPose ps = path.pose(f, opts.frames);
+                view.x = ps.x; view.y = ps.y; view.a = ps.a;
+                int n = unwritten_pixels(sc, *c, tm, db, &pool);
+                if(n && unwritten++ == 0)
+                    std::cout << n << " pixels of frame " << f << " of "
+                              << path.name << " at " << c->SCREEN_WIDTH << "x"
+                              << c->SCREEN_HEIGHT << " are never drawn.\n";
+            }
+        }
+    }
+
+    if(unwritten) {
+        std::cout << "\n" << unwritten << " frames leave pixels undrawn.\n";
+        return 1;
+    }
+
+    if(opts.record) {
+        std::cout << "\nGolden hashes written to " << opts.golden << ".\n";
+        return 0;
+    }
+    if(!checking) {
+        std::cout << "\nNo golden hashes in " << opts.golden
+                  << ", frames not checked.\n";
+        return 0;
+    }
+    std::cout << "\n" << mismatches << " frames differ from the golden ones";
+    if(unchecked)
+        std::cout << ", " << unchecked << " had none";
+    std::cout << ".\n";
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <cmath>
+
+#include "depthOrder.h"
+#include "linal.h"
+#include "timer.h"
+
+
+/* Depth ordering of sprites as draw() does it, with a full std::sort
+ * of every frame against depthOrder repairing last frame's order. Things
+ * are scattered over a square map and the player walks a circle through
+ * it 0.1 of a cell a frame, Thing::v of 3 cells a second at 30 frames a
+ * second, so the order changes a bit from frame to frame as in the game. */
+#define BENCH_FRAMES 200
+
+struct benchScene {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> dst;
+
+    benchScene(int n, float side) : x(n), y(n), dst(n) {
+        std::mt19937 rng(n);
+        std::uniform_real_distribution<float> pos(0, side);
+        for(int i = 0; i < n; ++i) {
+            x[i] = pos(rng);
+            y[i] = pos(rng);
+        }
+    };
+
+    void distances(int frame, float side) {
+        float r  = side/4;
+        float a  = frame * 0.1f / r;
+        float px = side/2 + r * std::cos(a);
+        float py = side/2 + r * std::sin(a);
+        for(size_t i = 0; i < x.size(); ++i) {
+            float dx = px - x[i], dy = py - y[i];
+            dst[i] = dot(dx, dy, dx, dy);
+        }
+    };
+};
+
+static double
+bench_full_sort(int n, float side, long long &check)
+{
+    benchScene sc(n, side);
+    std::vector<int> ids(n);
+    timer tmr{};
+    double took = 0;
+    for(int f = 0; f < BENCH_FRAMES; ++f) {
+        sc.distances(f, side);
+        tmr.reset();
+        for(int i = 0; i < n; ++i)
+            ids[i] = i;
+        std::sort(ids.begin(), ids.end(), [&](int a, int b) {
+            return std::isgreater(sc.dst[a], sc.dst[b]);
+        });
+        tmr.timeit();
+        took += tmr.getElapsedSC();
+        check += ids[0];
+    }
+    return took;
+}
+
+static double
+bench_depth_order(int n, float side, long long &check)
+{
+    benchScene sc(n, side);
+    depthOrder order;
+    timer tmr{};
+    double took = 0;
+    for(int f = 0; f < BENCH_FRAMES; ++f) {
+        sc.distances(f, side);
+        tmr.reset();
+        order.visible.resize(n);
+        for(int i = 0; i < n; ++i)
+            order.visible[i] = i;
+        order.update();
+        order.sort(sc.dst);
+        tmr.timeit();
+        took += tmr.getElapsedSC();
+        check += order.ids()[0];
+    }
+    return took;
+}
+
+int
+main()
+{
+    static const int counts[] = { 10, 1000, 100000 };
+    std::cout << "things   std::sort ms/frame   depthOrder ms/frame\n";
+    for(int n : counts) {
+        // About one thing per map cell.
+        float side = std::sqrt( (float)n );
+        long long full_check = 0, order_check = 0;
+        double full  = bench_full_sort  (n, side, full_check);
+        double order = bench_depth_order(n, side, order_check);
+        std::cout << n << "\t "
+                  << full  * 1000 / BENCH_FRAMES << "\t\t      "
+                  << order * 1000 / BENCH_FRAMES << "\n";
+        if(full_check != order_check) {
+            std::cout << "Orders differ!\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef CAMERA_SENTRY
+#define CAMERA_SENTRY
+
+
+#include <cmath>
+#include <vector>
+
+#include "linal.h"
+
+
+/* Rays of every screen column.
+ * Whatever depends only on FOV and screen width is kept until either of
+ * them changes, a frame only rotates it by the player's angle. */
+class camera {
+  public:
+    // pdirl should be 1 as computation of perpDist relies on it with
+    // FAST_DDA, and otherwise it can be any number anyway.
+    const float pdirl = 1;
+
+    // Player direction and camera plane, cdir is 90d to the left of pdir.
+    float pdirx = 0, pdiry = 0;
+    float cdirx = 0, cdiry = 0;
+
+    // Per column ray direction and ray length per unit of x and y.
+    std::vector<float> rdirx;
+    std::vector<float> rdiry;
+    std::vector<float> rxtl_ratio;
+    std::vector<float> rytl_ratio;
+#ifndef FAST_DDA
+    std::vector<float> rdirl;
+#endif
+
+    camera(float fov, int width) { setFov(fov); setWidth(width); };
+
+    float fov()   const { return m_fov; };
+    int   width() const { return m_width; };
+
+    void setFov(float fov) {
+        if(fov == m_fov)
+            return;
+        m_fov   = fov;
+        m_dirty = true;
+    };
+
+    void setWidth(int width) {
+        if(width == m_width)
+            return;
+        m_width = width;
+        m_dirty = true;
+    };
+
+    /* Points the camera at angle a. */
+    void update(float a) {
+        if(m_dirty)
+            rebuild();
+        else
+        if(a == m_a)
+            return;
+        m_a = a;
+
+        pdirx = pdirl*cos(a), pdiry = pdirl*sin(a);
+        float cdirl = m_h_fov_tan * pdirl;
+        cdirx = -pdiry/pdirl*cdirl, cdiry = pdirx/pdirl*cdirl;
+
+        for(int i = 0; i < m_width; ++i) {
+            float rx = pdirx+cdirx*m_cc[i];
+            float ry = pdiry+cdiry*m_cc[i];
+            rdirx[i] = rx;
+            rdiry[i] = ry;
+            // The main question is how much x and y contribute to ray
+            // length. So below is change in len of ray for each 1 unit
+            // change in x or y.
+#ifdef FAST_DDA
+            // In fact, instead of computing exactly the length of ray for
+            // one unit of x or y, we can do the same with just the ratios.
+            rxtl_ratio[i] = rx == 0 ? 1e30 : std::abs(1 / rx);
+            rytl_ratio[i] = ry == 0 ? 1e30 : std::abs(1 / ry);
+#else
+            rxtl_ratio[i] = rx == 0 ? 1e30 : std::abs(rdirl[i] / rx);
+            rytl_ratio[i] = ry == 0 ? 1e30 : std::abs(rdirl[i] / ry);
+#endif
+        }
+    };
+
+  private:
+    void rebuild() {
+        m_h_fov_tan = tan(m_fov/2);
+        m_cc.resize(m_width);
+        rdirx.resize(m_width);
+        rdiry.resize(m_width);
+        rxtl_ratio.resize(m_width);
+        rytl_ratio.resize(m_width);
+#ifndef FAST_DDA
+        rdirl.resize(m_width);
+#endif
+        for(int i = 0; i < m_width; ++i) {
+            // Cofficient for camera vector, from 1 to -1.
+            m_cc[i] = -(2.0*(float)i/(float)m_width - 1.0);
+#ifndef FAST_DDA
+            // Rotation keeps the length, so it is the same every frame.
+            float cl = m_h_fov_tan*pdirl*m_cc[i];
+            rdirl[i] = std::sqrt( dot(pdirl, cl, pdirl, cl) );
+#endif
+        }
+        m_dirty = false;
+    };
+
+    float m_fov   = 0;
+    int   m_width = 0;
+    float m_a     = 0;
+    bool  m_dirty = true;
+
+    float m_h_fov_tan = 0;
+    std::vector<float> m_cc;
+};
+
+
+#endif
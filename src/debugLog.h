@@ -0,0 +1,80 @@
+#ifndef DEBUGLOG_SENTRY
+#define DEBUGLOG_SENTRY
+
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+
+
+/* Diagnostics of the hot paths, kept in memory instead of being printed
+ * where they happen. At most LOG_RATE lines a second are kept, in a ring
+ * of the last LOG_LINES, the rest are only counted. flush() prints them
+ * from wherever printing does not get in the way. */
+#define LOG_LINES    256
+#define LOG_LINE_LEN 128
+#define LOG_RATE     32
+
+
+class debugLog {
+  public:
+    /* printf like, the line is cut at LOG_LINE_LEN. */
+    void write(const char *fmt, ...) {
+        std::lock_guard<std::mutex> lk(m_mx);
+        auto now = std::chrono::steady_clock::now();
+        if(now - m_second >= std::chrono::seconds(1)) {
+            m_second = now;
+            m_in_second = 0;
+        }
+        if(m_in_second++ >= LOG_RATE) {
+            ++m_dropped;
+            return;
+        }
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(m_lines[m_next++ % LOG_LINES], LOG_LINE_LEN, fmt, args);
+        va_end(args);
+    };
+
+    /* Prints the lines kept since the last flush() and forgets them. */
+    void flush(std::ostream &out) {
+        std::lock_guard<std::mutex> lk(m_mx);
+        if(m_next - m_flushed > LOG_LINES) {
+            m_dropped += m_next - m_flushed - LOG_LINES;
+            m_flushed  = m_next - LOG_LINES;
+        }
+        for(; m_flushed < m_next; ++m_flushed)
+            out << m_lines[m_flushed % LOG_LINES] << "\n";
+        if(m_dropped)
+            out << "(" << m_dropped << " more lines dropped)\n";
+        m_dropped = 0;
+    };
+
+  private:
+    char               m_lines[LOG_LINES][LOG_LINE_LEN];
+    unsigned long long m_next    = 0;
+    unsigned long long m_flushed = 0;
+    unsigned long long m_dropped = 0;
+    int                m_in_second = 0;
+    std::chrono::steady_clock::time_point m_second {};
+    std::mutex         m_mx;
+};
+
+/* The one log of the game. */
+inline debugLog &
+debug_log()
+{
+    static debugLog log;
+    return log;
+}
+
+#ifdef DEBUG
+#define DEBUG_LOG(...) debug_log().write(__VA_ARGS__)
+#else
+#define DEBUG_LOG(...)
+#endif
+
+
+#endif
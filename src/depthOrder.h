@@ -0,0 +1,94 @@
+#ifndef DEPTHORDER_SENTRY
+#define DEPTHORDER_SENTRY
+
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+
+/* Back to front order of visible things, kept from frame to frame.
+ * Things barely move between frames, so last frame's order is nearly the
+ * right one and an insertion sort repairs it in about O(n). Things that
+ * just came into view are sorted on their own and merged in. */
+class depthOrder {
+  public:
+    // Things visible this frame, in any order, filled by the caller.
+    std::vector<int> visible;
+
+    /* Drops from the order the things not visible anymore and puts the
+     * newly visible ones at its back. */
+    void update() {
+        ++m_stamp;
+        for(int id : visible) {
+            if(id >= (int)m_mark.size())
+                m_mark.resize(id+1, 0);
+            m_mark[id] = m_stamp;
+        }
+        // Marked ids already in the order keep their place.
+        size_t n = 0;
+        for(int id : m_ids)
+            if(id < (int)m_mark.size() && m_mark[id] == m_stamp) {
+                m_mark[id] = m_stamp - 1;
+                m_ids[n++] = id;
+            }
+        m_ids.resize(n);
+        m_kept = n;
+        for(int id : visible)
+            if(m_mark[id] == m_stamp) {
+                m_mark[id] = m_stamp - 1;
+                m_ids.push_back(id);
+            }
+    };
+
+    /* Orders ids by dst[id], farthest first, and ids at the same 
+     * distance by id. The order is then the same whichever order the ids
+     * came in, so whatever threads gathered them. */
+    void sort(const std::vector<float> &dst) {
+        auto farther = [&dst](int a, int b) {
+            return __farther(dst, a, b);
+        };
+        auto kept = m_ids.begin() + m_kept;
+        // A jump of the player leaves little of the order, and then an 
+        // insertion sort would be quadratic, so it gives up halfway.
+        if( !__insertionSort(m_ids.begin(), kept, dst, 8 * m_kept) )
+            std::sort(m_ids.begin(), kept, farther);
+        std::sort(kept, m_ids.end(), farther);
+        std::inplace_merge(m_ids.begin(), kept, m_ids.end(), farther);
+    };
+
+    const std::vector<int> &ids() const { return m_ids; };
+
+  private:
+    using iter = std::vector<int>::iterator;
+
+    static bool __farther(const std::vector<float> &dst, int a, int b) {
+        return std::isgreater(dst[a], dst[b]) || (dst[a] == dst[b] && a < b);
+    };
+
+    /* Returns false once more than budget ids had to be moved. */
+    static bool __insertionSort(iter begin, iter end, 
+                                const std::vector<float> &dst, size_t budget) {
+        for(iter i = begin; i < end; ++i) {
+            int   id = *i;
+            iter  j  = i;
+            for(; j > begin && __farther(dst, id, *(j-1)); --j) {
+                *j = *(j-1);
+                if(budget-- == 0) {
+                    *j = id;  // nothing lost, just unsorted
+                    return false;
+                }
+            }
+            *j = id;
+        }
+        return true;
+    };
+
+    std::vector<int>      m_ids;
+    size_t                m_kept = 0; // ids kept from last frame
+    std::vector<unsigned> m_mark;
+    unsigned              m_stamp = 1;
+};
+
+
+#endif
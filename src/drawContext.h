@@ -9,18 +9,41 @@
 #include <memory>
 #include <functional>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <errors.h>
 #include "pixel.h"
+#include "spans.h"
 
 
 using pos_t = int;
 
+enum DC_BACKENDS {
+    DC_SDL_TEXTURE,     // window + renderer + streaming texture
+    DC_CPU_FRAMEBUFFER, // plain memory, no window, no renderer
+};
+
+/* How frames of the SDL backend get into its texture. Frames rendered
+ * elsewhere, as the pipeline does, are copied in by show() either way. */
+enum DC_UPLOAD {
+    DC_UPLOAD_LOCK,   // drawn straight into the locked streaming texture
+    DC_UPLOAD_UPDATE, // drawn into CPU memory, SDL_UpdateTexture once done
+};
+
 class drawContext {
     public:
-        static const pos_t SCREEN_WIDTH  = 640;
-        static const pos_t SCREEN_HEIGHT = 480;
+        static const pos_t DEFAULT_WIDTH  = 640;
+        static const pos_t DEFAULT_HEIGHT = 480;
         static const uint_fast32_t SCALE = 64;
 
+        /* Resolution everything is rendered at. The window may be larger, 
+         * see init(). */
+        pos_t SCREEN_WIDTH  = DEFAULT_WIDTH;
+        pos_t SCREEN_HEIGHT = DEFAULT_HEIGHT;
+        pos_t WINDOW_WIDTH  = DEFAULT_WIDTH;
+        pos_t WINDOW_HEIGHT = DEFAULT_HEIGHT;
+
         std::unique_ptr<
                         SDL_Window, 
                         void(*)(SDL_Window *)
@@ -34,6 +57,11 @@ class drawContext {
                         void(*)(SDL_Texture *)
                        > m_screen {nullptr, SDL_DestroyTexture};
         
+        std::unique_ptr<
+                        uint32_t[],
+                        void(*)(void *)
+                       > m_framebuffer {nullptr, free};
+
         err_code m_error = NO_ERROR;
 
         #define WINDOW   m_window.get()
@@ -43,11 +71,23 @@ class drawContext {
         drawContext()  = default;
         ~drawContext() = default;
 
-        err_code init() {
+        /* The frame is rendered at w*render_scale x h*render_scale and 
+         * stretched over the w x h window. */
+        err_code init(DC_BACKENDS backend = DC_SDL_TEXTURE,
+                      pos_t w = DEFAULT_WIDTH, pos_t h = DEFAULT_HEIGHT,
+                      float render_scale = 1) {
+            m_backend = backend;
+            WINDOW_WIDTH  = w;
+            WINDOW_HEIGHT = h;
+            SCREEN_WIDTH  = std::max<pos_t>(1, w * render_scale);
+            SCREEN_HEIGHT = std::max<pos_t>(1, h * render_scale);
+            if(m_backend == DC_CPU_FRAMEBUFFER)
+                return initFramebuffer();
+
             SDL_Window *window = SDL_CreateWindow(
                 "Window name",
                 SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                SCREEN_WIDTH, SCREEN_HEIGHT,
+                WINDOW_WIDTH, WINDOW_HEIGHT,
                 SDL_WINDOW_SHOWN);
             if(!window) {
 #ifdef DEBUG
@@ -86,53 +126,155 @@ class drawContext {
                 return SCREEN_CREATION_FAIL;
             }
             m_screen.reset(screen); 
-            //m_screen_pixels = (uint32_t*)calloc(SCREEN_WIDTH*SCREEN_HEIGHT, sizeof(uint32_t));
 
             return NO_ERROR;
         };
+
+        /* Frames of the SDL backend are uploaded the upload way from now
+         * on. The CPU backend has nothing to upload to. */
+        err_code setUpload(DC_UPLOAD upload) {
+            if(isHeadless())
+                return NO_ERROR;
+            if(upload == DC_UPLOAD_UPDATE && !m_framebuffer) {
+                err_code ret = initFramebuffer();
+                if(ret != NO_ERROR)
+                    return ret;
+            }
+            m_upload = upload;
+            return NO_ERROR;
+        };
+        DC_UPLOAD upload() const { return m_upload; };
         
         bool isValid(){ return m_error == NO_ERROR; };
+        bool isHeadless() const { return m_backend == DC_CPU_FRAMEBUFFER; };
 
+        /* Frames cover the whole window, so it is never cleared. */
         void update() { 
-            //SDL_UpdateTexture(SCREEN, NULL, m_screen_pixels, SCREEN_WIDTH*4);
+            if(isHeadless())
+                return;
             SDL_RenderPresent(RENDERER); 
         };
 
-        void clear()  { 
-            SDL_SetRenderDrawColor(RENDERER, 0x80, 0x80, 0x80, 0xFF); 
-            SDL_RenderClear(RENDERER); 
+        /* Puts a frame rendered elsewhere, SCREEN_WIDTH x SCREEN_HEIGHT
+         * pixels, on the screen, to be presented by update(). It is 
+         * copied row by row into the locked texture, or uploaded whole. */
+        void show(const uint32_t *pixels) {
+            if(isHeadless())
+                return;
+            if(m_upload == DC_UPLOAD_UPDATE) {
+                SDL_UpdateTexture(SCREEN, NULL, pixels, 
+                                  SCREEN_WIDTH * sizeof(uint32_t));
+            } else {
+                uint32_t *dst;
+                int pitch;
+                if(SDL_LockTexture(SCREEN, NULL, (void**)&dst, &pitch) != 0)
+                    return;
+                for(int y = 0; y < SCREEN_HEIGHT; ++y)
+                    std::memcpy((char*)dst + (size_t)pitch * y, 
+                                pixels + (size_t)SCREEN_WIDTH * y,
+                                SCREEN_WIDTH * sizeof(uint32_t));
+                SDL_UnlockTexture(SCREEN);
+            }
+            SDL_RenderCopy(RENDERER, SCREEN, NULL, NULL);
         };
 
         void lock() {
+            if(isHeadless() || m_upload == DC_UPLOAD_UPDATE) {
+                m_screen_pixels = m_framebuffer.get();
+                m_stride = SCREEN_WIDTH;
+                return;
+            }
+            // Rows of the texture may be padded.
             int pitch;
             SDL_LockTexture(SCREEN, NULL, (void**)&m_screen_pixels, &pitch);
+            m_stride = pitch / sizeof(uint32_t);
         }
 
         void unlock() {
-            SDL_UnlockTexture(SCREEN);
-            SDL_RenderCopy(RENDERER, SCREEN, NULL, NULL);
+            if(!isHeadless()) {
+                if(m_upload == DC_UPLOAD_UPDATE)
+                    SDL_UpdateTexture(SCREEN, NULL, m_framebuffer.get(), 
+                                      SCREEN_WIDTH * sizeof(uint32_t));
+                else
+                    SDL_UnlockTexture(SCREEN);
+                SDL_RenderCopy(RENDERER, SCREEN, NULL, NULL);
+            }
             m_screen_pixels = NULL;
         }
 
+        /* Last rendered frame in CPU memory, SCREEN_WIDTH pixels per row. 
+         * NULL when frames are drawn straight into the SDL texture, as it
+         * is write-only. */
+        const uint32_t* pixels() const { return m_framebuffer.get(); };
+
+        err_code dump(const char *path) const {
+            const uint32_t *fb = pixels();
+            std::unique_ptr<FILE, int(*)(FILE *)> f { 
+                fb ? fopen(path, "wb") : NULL, fclose };
+            if(!f) {
+#ifdef DEBUG
+                std::cout << "Couldn't dump framebuffer into " << path << "\n"; 
+#endif
+                return FRAMEBUFFER_DUMP_FAIL;
+            }
+            fprintf(f.get(), "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+            for(int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; ++i) {
+                uint8_t rgb[3] = { 
+                    (uint8_t)GET_R(fb[i]), 
+                    (uint8_t)GET_G(fb[i]), 
+                    (uint8_t)(fb[i] & BMASK),
+                };
+                fwrite(rgb, 1, 3, f.get());
+            }
+            return NO_ERROR;
+        }
+
         void setPixel(int x, int y, int r, int g, int b, int a) {
+            if(isHeadless())
+                return;
             SDL_SetRenderDrawColor(RENDERER, r, g, b, a); 
             SDL_RenderDrawPoint(RENDERER, x, y);
         }
 
         void setPixel(int x, int y, uint32_t color) {
-            uint32_t prev_col = m_screen_pixels[SCREEN_WIDTH*y+x];
-            m_screen_pixels[SCREEN_WIDTH*y+x] = blend(prev_col, color); 
+            uint32_t prev_col = m_screen_pixels[m_stride*y+x];
+            m_screen_pixels[m_stride*y+x] = blend(prev_col, color); 
+        }
+
+        /* Writes color as its alpha class K requires. */
+        template<ALPHA_CLASS K>
+        void writePixel(int x, int y, uint32_t color) {
+            uint32_t &dst = m_screen_pixels[m_stride*y+x];
+            switch(K) {
+                case(ALPHA_OPAQUE): dst = color; break;
+                case(ALPHA_KEYED):  if(color & AMASK) dst = color; break;
+                default:            dst = blend(dst, color); break;
+            }
+        }
+
+        /* Spans are n pixels of row y starting at x, taken from src. */
+        void copySpan(int x, int y, const uint32_t *src, int n) {
+            span_kernels().copy(&m_screen_pixels[m_stride*y+x], src, n);
+        }
+
+        void maskSpan(int x, int y, const uint32_t *src, int n) {
+            span_kernels().mask(&m_screen_pixels[m_stride*y+x], src, n);
+        }
+
+        void blendSpan(int x, int y, const uint32_t *src, int n) {
+            span_kernels().blend(&m_screen_pixels[m_stride*y+x], src, n);
+        }
+
+        void writeSpan(ALPHA_CLASS k, int x, int y, const uint32_t *src, int n) {
+            switch(k) {
+                case(ALPHA_OPAQUE): copySpan (x, y, src, n); break;
+                case(ALPHA_KEYED):  maskSpan (x, y, src, n); break;
+                default:            blendSpan(x, y, src, n); break;
+            }
         }
 
         uint32_t blend(uint32_t orig_col, uint32_t new_col) {
-            //return new_col;
-            static const uint32_t RBMASK = RMASK | BMASK;
-            static const uint32_t AGMASK = AMASK | GMASK;
-            uint32_t a  = GET_A(new_col);
-            uint32_t na = 255 - a;
-            uint32_t rb = ((na * (orig_col & RBMASK)) + (a * (new_col & RBMASK))) >> 8;
-            uint32_t ag = (na * ((orig_col & AGMASK) >> 8)) + (a * (ONEALPHA | ((new_col & GMASK) >> 8)));
-            return ((rb & RBMASK) | (ag & AGMASK));
+            return blend_pixel(orig_col, new_col);
         }
 
         SDL_Window*   win_ptr() { return WINDOW; }; 
@@ -144,10 +286,30 @@ class drawContext {
         #undef SCREEN
 
   private:
+        err_code initFramebuffer() {
+            uint32_t *fb = reinterpret_cast<uint32_t*>(
+                calloc(SCREEN_WIDTH*SCREEN_HEIGHT, sizeof(uint32_t)) );
+            if(!fb) {
+#ifdef DEBUG
+                std::cout << "Couldn't allocate CPU framebuffer.\n"; 
+#endif
+                m_error = FRAMEBUFFER_CREATION_FAIL;
+                return FRAMEBUFFER_CREATION_FAIL;
+            }
+#ifdef DEBUG
+            std::cout << "CPU framebuffer created successfully.\n"; 
+#endif
+            m_framebuffer.reset(fb);
+            return NO_ERROR;
+        }
+
+        DC_BACKENDS m_backend = DC_SDL_TEXTURE;
+        DC_UPLOAD   m_upload  = DC_UPLOAD_LOCK;
         uint32_t *m_screen_pixels {nullptr};
+        int       m_stride = 0; // pixels from a row of m_screen_pixels to the next
 };
 
-#define INIT_DRAW_CONTEXT(name) drawContext dc{}; dc.init() 
+#define INIT_DRAW_CONTEXT(name, ...) drawContext name{}; name.init(__VA_ARGS__) 
 
 
 #endif
@@ -2,6 +2,8 @@
 #define ERRORS_SENTRY
 
 
+/* Codes are also the exit codes of the game, new ones go at the end so
+ * the old ones keep their values. */
 using err_code = int;
 enum ERRORS : err_code {
     NO_ERROR,
@@ -21,6 +23,20 @@ enum ERRORS : err_code {
     TILEMAP_NO_PIXELS_GOT,
     TILEMAP_CANNOT_CONVERT_PIXELS,
     TILEMAP_CANNOT_SET_COLOR_KEY,
+
+    FRAMEBUFFER_CREATION_FAIL,
+    FRAMEBUFFER_DUMP_FAIL,
+    OPTIONS_WRONG,
+
+    MAP_FILE_WRONG_FORMAT,
+    MAP_FILE_WRONG_VERSION,
+
+    TILEMAP_WRONG_TILE_SIZE,
+
+    TRACE_DUMP_FAIL,
+
+    REPLAY_FILE_NOT_OPENED,
+    REPLAY_FILE_WRONG_FORMAT,
 };
 
 
@@ -0,0 +1,163 @@
+#ifndef FRAMEPIPELINE_SENTRY
+#define FRAMEPIPELINE_SENTRY
+
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "drawContext.h"
+#include "things.h"
+
+
+/* All a frame is rendered from: where the player is seen from and where
+ * the things are, copied out of the simulation so it may go on ticking.
+ * The copy of things has a grid of its own as draw() writes into it. */
+struct frameSnapshot {
+    float x = 0, y = 0, a = 0;  // the player, already interpolated
+    float alpha = 1;            // of things, between px/py and x/y
+    Things    things;
+    thingGrid grid;
+    unsigned long long seq = 0; // set by framePipeline::publish()
+
+    frameSnapshot(const Map &map) : grid(map) { things.attach(grid); };
+};
+
+/* A frame rendered into CPU memory, minimap and all. */
+struct renderedFrame {
+    drawContext dc;
+    unsigned long long seq = 0; // of the snapshot it was rendered from
+};
+
+
+/* Renders frames on a thread of its own while the caller simulates and
+ * presents, so frame N is put on screen as frame N+1 is rendered.
+ *
+ * Snapshots travel from the caller to the render thread through a triple
+ * buffer: the caller fills back() and swaps it with the middle one, the
+ * render thread swaps the middle one with its front one when the caller
+ * left something new there. Neither ever waits on the other to get at a
+ * snapshot, and a render thread that falls behind only ever sees the
+ * latest one. Frames go the other way through two framebuffers. The
+ * mutex only guards the frame counters and puts threads to sleep. */
+class framePipeline {
+  public:
+    using renderFn = std::function<void(frameSnapshot&, drawContext&)>;
+
+    framePipeline(const Map &map, pos_t w, pos_t h, float scale,
+                  renderFn render)
+        : m_snaps{ {map}, {map}, {map} }, m_render(render) {
+        for(renderedFrame &f : m_frames) {
+            f.dc.init(DC_CPU_FRAMEBUFFER, w, h, scale);
+            if( !f.dc.isValid() ) {
+                m_error = f.dc.m_error;
+                return;
+            }
+        }
+        m_thread = std::thread(&framePipeline::__renderLoop, this);
+    };
+
+    ~framePipeline() {
+        {
+            std::lock_guard<std::mutex> lk(m_mx);
+            m_quit = true;
+        }
+        m_cv.notify_all();
+        if(m_thread.joinable())
+            m_thread.join();
+    };
+
+    framePipeline(const framePipeline &other)            = delete;
+    framePipeline &operator=(const framePipeline &other) = delete;
+
+    bool isValid() const { return m_error == NO_ERROR; };
+    err_code error() const { return m_error; };
+
+    /* Snapshot the caller may fill, only its own until publish(). */
+    frameSnapshot &back() { return m_snaps[m_back]; };
+
+    /* Hands back() over to the render thread. */
+    void publish() {
+        m_snaps[m_back].seq = ++m_published;
+        m_back = m_middle.exchange(m_back | FRESH) & ~FRESH;
+        // Taking the lock keeps the render thread from missing the wakeup.
+        { std::lock_guard<std::mutex> lk(m_mx); }
+        m_cv.notify_all();
+    };
+
+    /* Waits for the frame of the snapshot published before the last one,
+     * so the last one is being rendered meanwhile, and returns the newest
+     * frame done. Older frames nobody presented are dropped. NULL before
+     * the first frame is done. */
+    const renderedFrame *acquire() {
+        std::unique_lock<std::mutex> lk(m_mx);
+        m_cv.wait(lk, [this]{
+            return m_quit || m_done_seq + 1 >= m_published; });
+        if(m_rendered == m_presented)
+            return nullptr;
+        m_presented = m_rendered - 1;
+        return &m_frames[m_presented % 2];
+    };
+
+    /* The frame acquire() returned may be rendered into again. */
+    void release() {
+        {
+            std::lock_guard<std::mutex> lk(m_mx);
+            ++m_presented;
+        }
+        m_cv.notify_all();
+    };
+
+  private:
+    static const unsigned FRESH = 4;
+
+    void __renderLoop() {
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lk(m_mx);
+                m_cv.wait(lk, [this]{
+                    return m_quit || ( (m_middle.load() & FRESH) &&
+                                       m_rendered - m_presented < 2 );
+                });
+                if(m_quit)
+                    return;
+            }
+            m_front = m_middle.exchange(m_front) & ~FRESH;
+            frameSnapshot &s = m_snaps[m_front];
+            // Only the render thread moves m_rendered, and the caller is
+            // done with this frame until m_rendered - m_presented < 2.
+            renderedFrame &f = m_frames[m_rendered % 2];
+            m_render(s, f.dc);
+            f.seq = s.seq;
+            {
+                std::lock_guard<std::mutex> lk(m_mx);
+                ++m_rendered;
+                m_done_seq = f.seq;
+            }
+            m_cv.notify_all();
+        }
+    };
+
+    frameSnapshot   m_snaps[3];
+    unsigned        m_back  = 0;         // the caller's
+    unsigned        m_front = 1;         // the render thread's
+    std::atomic<unsigned> m_middle {2};  // with FRESH once published
+    unsigned long long    m_published = 0; // the caller's
+
+    renderedFrame   m_frames[2];
+    unsigned long long m_rendered  = 0;  // frames done
+    unsigned long long m_presented = 0;  // frames released
+    unsigned long long m_done_seq  = 0;  // snapshot of the last frame done
+
+    renderFn        m_render;
+    err_code        m_error = NO_ERROR;
+    bool            m_quit  = false;
+    std::mutex      m_mx;
+    std::condition_variable m_cv;
+    std::thread     m_thread;
+};
+
+
+#endif
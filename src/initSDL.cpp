@@ -14,9 +14,11 @@ void cleanup_at_exit(void)
 #endif
 }
 
-err_code initial_setup(void)
+err_code initial_setup(bool headless)
 {
-    if( SDL_Init(SDL_INIT_VIDEO) < 0 ) {
+    // Headless runs draw into plain memory, so there is no video to init.
+    Uint32 sdl_flags = headless ? 0 : SDL_INIT_VIDEO;
+    if( SDL_Init(sdl_flags) < 0 ) {
 #ifdef DEBUG
         std::cout << "Couldn't init SDL with error " << SDL_GetError() << "\n"; 
 #endif
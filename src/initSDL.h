@@ -7,7 +7,7 @@
 void 
 cleanup_at_exit(void);
 err_code 
-initial_setup(void);
+initial_setup(bool headless = false);
 
 
 #endif
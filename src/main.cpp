@@ -1,41 +1,69 @@
 #include <SDL2/SDL.h>
 #include <cstddef>
 #include <memory>
+#include <fstream>
 
 #include "initSDL.h"
+#include "options.h"
 #include "render.h"
+#include "renderPool.h"
 #include "drawContext.h"
 #include "things.h"
 #include "miniMap.h"
 #include "scene.h"
+#include "camera.h"
 #include "tileMap.h"
 #include "errors.h"
+#include "spans.h"
+#include "simulation.h"
+#include "replay.h"
+#include "debugLog.h"
+#include "framePipeline.h"
+#include "timer.h"
+#include "profiler.h"
 
 
 #ifndef ASSETS_PATH
-#define ASSETS "."
+#define ASSETS_PATH "."
 #endif
 
-#ifdef BENCH_RENDER
-#include "timer.h"
-#endif
 
 
 int 
 main(int argc, char **argv)
 {
 
-    err_code ret = initial_setup();
+    options opts{};
+    err_code ret = parse_options(argc, argv, opts);
+    if(ret != NO_ERROR)
+        std::exit(ret);
+
+    if( !select_span_kernels(opts.simd) ) {
+        std::cout << "This CPU cannot run the requested span kernels.\n";
+        std::exit(OPTIONS_WRONG);
+    }
+#ifdef DEBUG
+    std::cout << "Using " << span_kernels().name << " span kernels.\n";
+#endif
+
+    ret = initial_setup(opts.headless);
     if(ret != NO_ERROR)
         std::exit(ret);
    
-    INIT_DRAW_CONTEXT(dc);
+    INIT_DRAW_CONTEXT(dc, 
+        opts.headless ? DC_CPU_FRAMEBUFFER : DC_SDL_TEXTURE,
+        opts.width, opts.height, opts.scale);
     if ( !dc.isValid() )
         std::exit(dc.m_error);
+    ret = dc.setUpload(opts.upload);
+    if(ret != NO_ERROR)
+        std::exit(ret);
 
     Map map(ASSETS_PATH"/maps/test_map");
     if( !map.isLoaded() )
         std::exit(MAP_NOT_LOADED);
+    // Rasterised with the map, so the first frame costs no more than any.
+    miniMap mm{map, opts.scale};
 
     tileMap tm;
     tm.load(ASSETS_PATH"/maps/test_map/pack2.png");
@@ -43,63 +71,209 @@ main(int argc, char **argv)
         std::exit(TILEMAP_NOT_LOADED);
 
     tileMap coin_txt{0x0000FF00};
-    coin_txt.load(ASSETS_PATH"/items/my_coin.png");
+    coin_txt.load(ASSETS_PATH"/items/my_coin.png", 0, 0); // a single tile
     if( !coin_txt.isLoaded() )
         std::exit(TILEMAP_NOT_LOADED);
 
+    tm.setMipmaps(opts.mipmaps);
+    coin_txt.setMipmaps(opts.mipmaps);
+    tm.setTransposed(opts.transposed_walls);
+
     Thing player(1.5, 1.5);
-    Thing coin1{4.5, 4.5, &coin_txt, 0};
-    Thing coin2{1.5, 1.5, &coin_txt, 0};
+    // Where the player is drawn, between the last two ticks.
+    Thing view(player.x, player.y);
 
     Things things{};
     int min_things_no = 16;
-    std::vector<int> things_ids_buff{};
+    depthOrder things_order{};
     std::vector<float> dists_to_player{};
     things.reserve(min_things_no);
-    things_ids_buff.resize(min_things_no);
     dists_to_player.resize(min_things_no);
     
-    things.push_back( std::move(coin1) );
-    things.push_back( std::move(coin2) );
+    things.add(4.5, 4.5, &coin_txt, 0);
+    things.add(1.5, 1.5, &coin_txt, 0);
 
-    miniMap mm{};
+    thingGrid grid{map};
+    things.attach(grid);
+
+    camera  cam{ float(opts.fov * PI / 180), dc.SCREEN_WIDTH };
 
     scene sc {
-        map, player, things, mm,
+        map, view, things, grid, mm, cam, 1,
     };
 
     std::unique_ptr<float[]> z_buffer( new float[dc.SCREEN_WIDTH] );
-    drawBuffers db {z_buffer.get(), dists_to_player, things_ids_buff};
+    std::unique_ptr<int[]>   floor_h ( new int  [dc.SCREEN_WIDTH] );
+    drawBuffers db {
+        z_buffer.get(), floor_h.get(), dists_to_player, things_order
+    };
+
+    renderPool pool{opts.threads};
+
+    // A replay starts where the recording did.
+    replayPlayer replay;
+    if(opts.replay_path) {
+        ret = replay.load(opts.replay_path, SIM_TICK_HZ, map);
+        if(ret != NO_ERROR)
+            std::exit(ret);
+        replay.start(player);
+    }
+
+    simulation sim{map, player, things};
+
+    replayRecorder recorder;
+    if(opts.record_path) {
+        ret = recorder.open(opts.record_path, player, SIM_TICK_HZ, map);
+        if(ret != NO_ERROR)
+            std::exit(ret);
+        sim.setRecorder(&recorder);
+    }
+
+    // How long every frame took, one "frame,ms" line each.
+    std::ofstream frame_times;
+    if(opts.frame_times_path) {
+        frame_times.open(opts.frame_times_path, std::ios::trunc);
+        frame_times << "frame,ms\n";
+    }
+
+    /* With a window, frames are rendered on a thread of their own from
+     * snapshots of the world, and only presented here. */
+    std::unique_ptr<framePipeline> pipe;
+#ifndef NO_RENDER_TEX
+    if( !opts.headless && opts.pipeline ) {
+        auto render = [&](frameSnapshot &s, drawContext &frame_dc) {
+            Thing frame_view(s.x, s.y);
+            frame_view.a = s.a;
+            auto th_size = s.things.slots();
+            if(db.things_dst.size() < th_size) 
+                db.things_dst.resize(th_size * 2);
+            scene frame_sc {
+                map, frame_view, s.things, s.grid, mm, cam, s.alpha,
+            };
+            draw(frame_sc, frame_dc, tm, db, &pool);
+        };
+        pipe.reset( new framePipeline(map, opts.width, opts.height, 
+                                      opts.scale, render) );
+        if( !pipe->isValid() )
+            std::exit(pipe->error());
+    }
+#endif
 
     SDL_Event e; 
     bool canRun = true; 
+    int  frame  = 0;
+    timer frame_clock{};
+    frame_clock.reset();
+    timer frame_tmr{}, run_tmr{};
+    run_tmr.reset();
 #ifdef BENCH_RENDER
-        timer tmr{};
+    prof().setTracing(opts.trace_path != nullptr);
 #endif
     while(canRun) {
-        auto th_size = things.size();
-        if(db.things_ids.size() < th_size) db.things_ids.resize(th_size * 2);
-        if(db.things_dst.size() < th_size) db.things_dst.resize(th_size * 2);
+        frame_tmr.reset();
+#ifdef BENCH_RENDER
+        prof_ns t_frame = prof_now();
+#endif
+        auto th_size = things.slots();
+        if(!pipe && db.things_dst.size() < th_size) 
+            db.things_dst.resize(th_size * 2);
 
-        while( SDL_PollEvent(&e) ) {
+        while( !opts.headless && SDL_PollEvent(&e) ) {
             if(e.type == SDL_QUIT) {
                 canRun = false;
-            } else
-            if(e.type == SDL_KEYDOWN) {
-                player.handle( e.key.keysym.sym, map);
             }
         }
+        /* Replays and headless runs step the world once per frame, as fast
+         * as frames are rendered, and draw exactly the last tick. */
+        if(replay.isLoaded()) {
+            if(replay.done())
+                break;
+            PROF_ZONE(PZ_SIMULATE);
+            sim.tick( replay.next() );
+            replay.check(player);
+            sc.alpha = 1;
+        } else
+        if(opts.headless) {
+            PROF_ZONE(PZ_SIMULATE);
+            sim.tick( playerInput{} );
+            sc.alpha = 1;
+        } else {
+            frame_clock.timeit();
+            double elapsed = frame_clock.getElapsedSC();
+            frame_clock.reset();
+            PROF_ZONE(PZ_SIMULATE);
+            sim.advance(elapsed, read_keyboard());
+            sc.alpha = sim.alpha();
+        }
+        sim.interpolate(view, sc.alpha);
+        if(pipe) {
+            frameSnapshot &snap = pipe->back();
+            snap.x = view.x; snap.y = view.y; snap.a = view.a;
+            snap.alpha = sc.alpha;
+            snap.things.copyFrom(things);
+            pipe->publish();
+            // The frame before, rendered while the last one was simulated.
+            const renderedFrame *f = pipe->acquire();
+            if(f) {
+                PROF_ZONE(PZ_PRESENT);
+                dc.show(f->dc.pixels());
+                dc.update();
+                pipe->release();
+            }
+        } else {
+            draw(sc, dc, tm, db, &pool);
+            PROF_ZONE(PZ_PRESENT);
+            dc.update();
+        }
 #ifdef BENCH_RENDER
-        tmr.reset();
+        prof().zone(PZ_FRAME, t_frame, prof_now());
+        prof().endFrame();
+        if(opts.profile_every && prof().frames() % opts.profile_every == 0)
+            prof().report(std::cout);
+#endif
+#ifdef DEBUG
+        // Printed here, between frames, instead of where it happened.
+        debug_log().flush(std::cout);
 #endif
-        dc.clear();
-        draw(sc, dc, tm, db);
-        mm.draw(map, player, dc);
-        dc.update();
+        if(frame_times.is_open()) {
+            frame_tmr.timeit();
+            frame_times << frame << "," << frame_tmr.getElapsedSC() * 1000 
+                        << "\n";
+        }
+        if(++frame >= opts.frames && opts.frames)
+            canRun = false;
+    }
+
+    if(replay.isLoaded()) {
+        run_tmr.timeit();
+        std::cout << "Replayed " << sim.ticks() << " of " << replay.ticks()
+                  << " ticks in " << run_tmr.getElapsedSC() << " seconds, "
+                  << sim.ticks() / run_tmr.getElapsedSC() << " frames/s.\n";
+        if(replay.desync() >= 0)
+            std::cout << "The player went astray of the recording at tick "
+                      << replay.desync() << ".\n";
+    }
+
+    // std::exit() skips destructors, the render thread is stopped and 
+    // files are closed first.
+    pipe.reset();
+    recorder.close();
+    frame_times.close();
+
 #ifdef BENCH_RENDER
-        tmr.timeit();
-        std::cout << "Render took " << tmr.getElapsedSC() << " seconds." << std::endl;
+    if( !opts.profile_every || prof().frames() % opts.profile_every )
+        prof().report(std::cout);
+    if(opts.trace_path) {
+        ret = prof().writeTrace(opts.trace_path);
+        if(ret != NO_ERROR)
+            std::exit(ret);
+    }
 #endif
+
+    if(opts.dump_path) {
+        ret = dc.dump(opts.dump_path);
+        if(ret != NO_ERROR)
+            std::exit(ret);
     }
 
     std::exit(EXIT_SUCCESS);
@@ -0,0 +1,363 @@
+#ifndef MAPFILE_SENTRY
+#define MAPFILE_SENTRY
+
+
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPFILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "errors.h"
+
+
+/* Binary map container, map.bin next to the text layers:
+ *
+ *   mapFileHeader | mapFileLayer * layers | layer data ...
+ *
+ * Fields are little endian, every layer is 8 bytes aligned, so the file
+ * can be mapped and its layers used in place. Layers hold w*h cells, rows
+ * in the same order as in the text files (top row of the map first).
+ *
+ * Version 1 holds the four LAYERS_NO layers, one char per cell each.
+ * Version 2 holds a single LAYER_CELLS layer of mapCells instead. With 
+ * LAYER_BORDERED in its flags that layer already has the solid border Map
+ * keeps around every map, so it is (w+2)*(h+2) cells. */
+#define MAP_FILE_NAME    "map.bin"
+#define MAP_FILE_MAGIC   "WOOFMAP"
+#define MAP_FILE_VERSION 2
+
+enum MAP_LAYERS : uint32_t {
+    LAYER_WALLS,
+    LAYER_FLOOR,
+    LAYER_CEIL,
+    LAYER_COLL,
+    LAYERS_NO,
+
+    LAYER_CELLS = 16,
+};
+
+enum MAP_LAYER_FLAGS : uint32_t {
+    LAYER_BORDERED = 1,
+};
+
+enum MAP_ERRORS : signed char {
+    OUT_OF_BOUNDS = -1,
+};
+
+enum COLLISIONS : char {
+    FLOOR         = 0,
+    WALL          = 1,
+};
+
+/* Everything about one map cell, so a single cache line serves all the
+ * layers of 16 neighbouring cells. */
+struct mapCell {
+    char wall;
+    char floor;
+    char ceil;
+    char coll;
+};
+
+/* Beyond the map nothing is there, but it is solid. */
+static const mapCell BORDER_CELL = {
+    OUT_OF_BOUNDS, OUT_OF_BOUNDS, OUT_OF_BOUNDS, WALL,
+};
+
+struct mapFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t w;
+    uint32_t h;
+    uint32_t layers;
+};
+
+struct mapFileLayer {
+    uint32_t kind;
+    uint32_t flags;
+    uint64_t offset; // from the start of the file
+    uint64_t size;   // in bytes
+};
+
+
+/* Read only view of a whole file. Mapped where the OS can do it, read
+ * into memory otherwise. */
+class mapFile {
+  public:
+    mapFile() {};
+    ~mapFile() { close(); };
+
+    mapFile(const mapFile &other)            = delete;
+    mapFile &operator=(const mapFile &other) = delete;
+
+    bool open(const std::string &path) {
+        close();
+#ifdef MAPFILE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED)
+            return false;
+        m_data   = reinterpret_cast<const char*>(p);
+        m_size   = st.st_size;
+        m_mapped = true;
+#else
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if( !f.good() )
+            return false;
+        size_t size = f.tellg();
+        char *p = reinterpret_cast<char*>( malloc(size) );
+        if(!p || size == 0 || !f.seekg(0).read(p, size)) {
+            free(p);
+            return false;
+        }
+        m_data = p;
+        m_size = size;
+#endif
+        return true;
+    };
+
+    void close() {
+        if(!m_data)
+            return;
+#ifdef MAPFILE_MMAP
+        if(m_mapped)
+            munmap(const_cast<char*>(m_data), m_size);
+#endif
+        if(!m_mapped)
+            free(const_cast<char*>(m_data));
+        m_data   = nullptr;
+        m_size   = 0;
+        m_mapped = false;
+    };
+
+    void swap(mapFile &other) {
+        std::swap(m_data,   other.m_data);
+        std::swap(m_size,   other.m_size);
+        std::swap(m_mapped, other.m_mapped);
+    };
+
+    const char *data() const { return m_data; };
+    size_t      size() const { return m_size; };
+
+  private:
+    const char *m_data   = nullptr;
+    size_t      m_size   = 0;
+    bool        m_mapped = false;
+};
+
+
+/* Reads one of walls.txt, floor.txt, ceil.txt or coll.txt: dimensions
+ * followed by w*h single digit cells. */
+inline err_code
+read_text_layer(const std::string &path, int &w, int &h,
+                std::vector<char> &cells)
+{
+    std::ifstream f_map(path);
+    if( !f_map.good() ) {
+#ifdef DEBUG
+        std::cout << "Cannot open map in " << path << std::endl;
+#endif
+        return MAP_FILE_NOT_OPENED;
+    }
+    int map_w = 0, map_h = 0;
+    f_map >> map_w >> map_h;
+    int wh = map_w * map_h;
+    if(map_w <= 0 || map_h <= 0) {
+#ifdef DEBUG
+        std::cout << "Wrong dimensions of map " << path << std::endl;
+#endif
+        return MAP_WRONG_DIMENSIONS;
+    }
+    cells.assign(wh, 0);
+    int i = 0;
+    char c;
+    while( i < wh && f_map >> c )
+        cells[i++] = c - 48; //ascii
+
+    if(i != wh) {
+#ifdef DEBUG
+        std::cout << "Wrong dimensions of map " << path << std::endl;
+#endif
+        return MAP_WRONG_DIMENSIONS;
+    }
+    w = map_w; h = map_h;
+    return NO_ERROR;
+}
+
+/* Sets the one cell wide border of (w+2)*(h+2) cells. */
+inline void
+border_cells(int w, int h, mapCell *bordered)
+{
+    int stride = w + 2;
+    for(int x = 0; x < stride; ++x) {
+        bordered[x] = BORDER_CELL;
+        bordered[(h+1)*stride + x] = BORDER_CELL;
+    }
+    for(int y = 1; y <= h; ++y) {
+        bordered[y*stride] = BORDER_CELL;
+        bordered[y*stride + w+1] = BORDER_CELL;
+    }
+}
+
+/* Whether the border of (w+2)*(h+2) bordered cells is solid all around,
+ * which is all the renderer counts on to stay within the cells. */
+inline bool
+border_is_solid(int w, int h, const mapCell *bordered)
+{
+    int stride = w + 2;
+    for(int x = 0; x < stride; ++x)
+        if(bordered[x].coll != WALL || bordered[(h+1)*stride + x].coll != WALL)
+            return false;
+    for(int y = 1; y <= h; ++y)
+        if(bordered[y*stride].coll != WALL || bordered[y*stride + w+1].coll != WALL)
+            return false;
+    return true;
+}
+
+/* Packs the four char layers of w*h cells into the inside of 
+ * (w+2)*(h+2) bordered cells. */
+inline void
+interleave_layers(int w, int h, const char *const (&layers)[LAYERS_NO], 
+                  mapCell *bordered)
+{
+    int stride = w + 2;
+    border_cells(w, h, bordered);
+    for(int y = 0; y < h; ++y) {
+        mapCell *row = &bordered[(y+1)*stride + 1];
+        for(int x = 0; x < w; ++x) {
+            size_t i = (size_t)y*w + x;
+            row[x].wall  = layers[LAYER_WALLS][i];
+            row[x].floor = layers[LAYER_FLOOR][i];
+            row[x].ceil  = layers[LAYER_CEIL ][i];
+            row[x].coll  = layers[LAYER_COLL ][i];
+        }
+    }
+}
+
+/* Copies w*h cells into the inside of (w+2)*(h+2) bordered cells. */
+inline void
+border_copy(int w, int h, const mapCell *cells, mapCell *bordered)
+{
+    int stride = w + 2;
+    border_cells(w, h, bordered);
+    for(int y = 0; y < h; ++y)
+        std::memcpy(&bordered[(y+1)*stride + 1], &cells[(size_t)y*w], 
+                    w * sizeof(mapCell));
+}
+
+/* Whether a w*h map can be kept, cells are told apart by int indices
+ * into (w+2)*(h+2) bordered cells. */
+inline bool
+map_dimensions_fit(uint64_t w, uint64_t h)
+{
+    if(w == 0 || h == 0 || w > INT_MAX - 2 || h > INT_MAX - 2)
+        return false;
+    return (w + 2) * (h + 2) <= INT_MAX;
+}
+
+/* Checks a whole map file and finds its layers: either cells (bordered
+ * or not) or, for version 1 files, the four char layers. Only the header
+ * and the layer table are touched, cells are left to page in when used. */
+inline err_code
+parse_map_file(const char *data, size_t size, const mapFileHeader *&hdr,
+               const mapCell *&cells, bool &bordered,
+               const char *(&layers)[LAYERS_NO])
+{
+    cells    = nullptr;
+    bordered = false;
+    for(auto &l : layers)
+        l = nullptr;
+    hdr = reinterpret_cast<const mapFileHeader*>(data);
+    if(size < sizeof(mapFileHeader)
+    || 0 != std::memcmp(hdr->magic, MAP_FILE_MAGIC, sizeof(hdr->magic)))
+        return MAP_FILE_WRONG_FORMAT;
+    if(hdr->version != 1 && hdr->version != MAP_FILE_VERSION)
+        return MAP_FILE_WRONG_VERSION;
+    if( !map_dimensions_fit(hdr->w, hdr->h) )
+        return MAP_WRONG_DIMENSIONS;
+
+    uint64_t wh = (uint64_t)hdr->w * hdr->h;
+    uint64_t table_end = sizeof(mapFileHeader)
+                       + (uint64_t)hdr->layers * sizeof(mapFileLayer);
+    if(table_end > size)
+        return MAP_FILE_WRONG_FORMAT;
+    auto table = reinterpret_cast<const mapFileLayer*>(
+        data + sizeof(mapFileHeader) );
+    for(uint32_t i = 0; i < hdr->layers; ++i) {
+        const mapFileLayer &l = table[i];
+        if(l.offset > size || l.size > size - l.offset)
+            return MAP_FILE_WRONG_FORMAT;
+        if(l.kind == LAYER_CELLS) {
+            bordered = l.flags & LAYER_BORDERED;
+            uint64_t bw = (uint64_t)hdr->w + 2, bh = (uint64_t)hdr->h + 2;
+            uint64_t n  = bordered ? bw * bh : wh;
+            if(l.size != n * sizeof(mapCell) || l.offset % alignof(mapCell))
+                return MAP_WRONG_DIMENSIONS;
+            cells = reinterpret_cast<const mapCell*>(data + l.offset);
+            continue;
+        }
+        if(l.kind >= LAYERS_NO)
+            continue; // newer layer kinds are not ours to read
+        if(l.size != wh)
+            return MAP_WRONG_DIMENSIONS;
+        layers[l.kind] = data + l.offset;
+    }
+    if(cells)
+        return NO_ERROR;
+    for(auto &l : layers)
+        if(!l)
+            return MAP_FILE_WRONG_FORMAT;
+    return NO_ERROR;
+}
+
+/* Writes (w+2)*(h+2) bordered cells into a map file at path. */
+inline err_code
+write_map_file(const std::string &path, int w, int h, const mapCell *bordered)
+{
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if( !f.good() )
+        return MAP_FILE_NOT_OPENED;
+
+    mapFileHeader hdr;
+    std::memcpy(hdr.magic, MAP_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = MAP_FILE_VERSION;
+    hdr.w       = w;
+    hdr.h       = h;
+    hdr.layers  = 1;
+
+    auto align = [](uint64_t o){ return (o + 7) & ~(uint64_t)7; };
+    mapFileLayer table[1];
+    table[0].kind   = LAYER_CELLS;
+    table[0].flags  = LAYER_BORDERED;
+    table[0].offset = align(sizeof(hdr) + sizeof(table));
+    table[0].size   = (uint64_t)(w+2) * (h+2) * sizeof(mapCell);
+
+    f.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    f.write(reinterpret_cast<const char*>(table), sizeof(table));
+    while( (uint64_t)f.tellp() < table[0].offset )
+        f.put(0);
+    f.write(reinterpret_cast<const char*>(bordered), table[0].size);
+    return f.good() ? NO_ERROR : MAP_FILE_NOT_OPENED;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapFile.h"
+#include "errors.h"
+
+
+/* Offline converter from the text layers of a map directory into its
+ * MAP_FILE_NAME, which Map::load() then prefers. */
+int 
+main(int argc, char **argv)
+{
+    if(argc != 2) {
+        std::cout << "Usage: " << argv[0] << " <map directory>\n";
+        return MAP_FILE_NOT_OPENED;
+    }
+    std::string dir(argv[1]);
+
+    static const char *names[LAYERS_NO] = {
+        "/walls.txt", "/floor.txt", "/ceil.txt", "/coll.txt",
+    };
+    std::vector<char> layers[LAYERS_NO];
+    int w = 0, h = 0;
+    for(uint32_t i = 0; i < LAYERS_NO; ++i) {
+        int lw = 0, lh = 0;
+        err_code ret = read_text_layer(dir + names[i], lw, lh, layers[i]);
+        if(ret != NO_ERROR) {
+            std::cout << "Cannot read " << dir + names[i] << ".\n";
+            return ret;
+        }
+        if(i != 0 && (lw != w || lh != h)) {
+            std::cout << "Wrong dimensions of " << dir + names[i] << ".\n";
+            return MAP_WRONG_DIMENSIONS;
+        }
+        w = lw; h = lh;
+    }
+
+    const char *const planes[LAYERS_NO] = {
+        layers[LAYER_WALLS].data(), layers[LAYER_FLOOR].data(),
+        layers[LAYER_CEIL ].data(), layers[LAYER_COLL ].data(),
+    };
+    std::vector<mapCell> cells( (size_t)(w+2) * (h+2) );
+    interleave_layers(w, h, planes, cells.data());
+
+    std::string out = dir + "/" MAP_FILE_NAME;
+    err_code ret = write_map_file(out, w, h, cells.data());
+    if(ret != NO_ERROR) {
+        std::cout << "Cannot write " << out << ".\n";
+        return ret;
+    }
+    std::cout << "Wrote " << out << ", " << w << "x" << h << ".\n";
+    return NO_ERROR;
+}
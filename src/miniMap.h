@@ -2,102 +2,170 @@
 #define MINIMAP_SENTRY
 
 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_blendmode.h>
-#include <SDL2/SDL_render.h>
 #include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 
 #include "drawContext.h"
 #include "things.h"
 
 
+/* A line in map space, xy with origin in BOT LEFT. */
+struct mmLine {
+    float    x1, y1, x2, y2;
+    uint32_t col;
+};
+
+/* The map is rasterised once, when it is loaded, into an image of its
+ * own, which is blended over the top left corner of every frame as one
+ * span a row, so a frame costs the same however large the map is. The 
+ * player and lines are drawn over it. Everything is written into the 
+ * frame while dc is locked, rows and columns past the frame are clipped.
+ * Cells are m_scale window pixels wide, so frames rendered at a scale of
+ * the window get the minimap scaled alike and it looks the same. */
 class miniMap {
     uint8_t m_alpha = 100;
-   
+
   public:
     int m_scale = 32;
-    miniMap() {};
-    miniMap(int s) : m_scale(s) {};
+    bool m_rays = true; // DEBUG builds draw the rays cast over it
+    miniMap(const Map &m, float render_scale = 1) { build(m, render_scale); };
+    miniMap(const Map &m, float render_scale, int s) : m_scale(s) { 
+        build(m, render_scale); 
+    };
     ~miniMap() {};
 
-    void draw(Map &m, Thing &p, drawContext &dc) {
-        SDL_BlendMode cb;
-        SDL_Renderer *rend = dc.ren_ptr();
-        SDL_GetRenderDrawBlendMode(rend, &cb);
-        SDL_SetRenderDrawBlendMode(rend, SDL_BLENDMODE_BLEND);
-        draw(m, dc);
-        draw(p, dc, m.w, m.h);
-        SDL_SetRenderDrawBlendMode(rend, cb);
+    void draw(const Map &m, const Thing &p, drawContext &dc) {
+        draw(dc);
+        draw(p, dc, m.h);
     }
 
-    void draw(Map &m, drawContext &dc) {
-        int h = m.h, w = m.w;
-        for(int i = 0; i < h; ++i) {
-            for(int j = 0; j < w; ++j) {
-                char c = m.getCollision(j, i);
-                SDL_Renderer *rend = dc.ren_ptr();
-                SDL_Rect t = { 
-                    j*m_scale, (h-i-1)*m_scale, m_scale, m_scale,
-                };
-                switch(c) {
-                    case(FLOOR): {
-                        SDL_SetRenderDrawColor(rend, 0x00, 0x00, 0x00, m_alpha); 
-                        break;
-                    }
-                    case(WALL): {
-                        SDL_SetRenderDrawColor(rend, 0xFF, 0xF2, 0x00, m_alpha); 
-                        break;
-                    }
-                    default: {
-                        SDL_SetRenderDrawColor(rend, 0xFF, 0xFF, 0xFF, m_alpha); 
-                        break;
-                    }
+    /* Rasterises m for frames rendered at render_scale of the window, 
+     * the map may not change afterwards unless it is built again. */
+    void build(const Map &m, float render_scale = 1) {
+        m_px  = std::max(1, (int)std::lround(m_scale * render_scale));
+        m_iw  = m.w * m_px;
+        m_ih  = m.h * m_px;
+        m_image.assign((size_t)m_iw * m_ih, 0);
+
+        uint32_t a      = (uint32_t)m_alpha << 24;
+        uint32_t grid   = a | 0x808080;
+        for(int i = 0; i < m.h; ++i) {
+            for(int j = 0; j < m.w; ++j) {
+                uint32_t col;
+                switch(m.getCollision(j, i)) {
+                    case(FLOOR): col = a | 0x000000; break;
+                    case(WALL):  col = a | 0xFFF200; break;
+                    default:     col = a | 0xFFFFFF; break;
+                }
+                int x0 = j*m_px, y0 = (m.h-i-1)*m_px;
+                for(int y = 0; y < m_px; ++y) {
+                    uint32_t *row = &m_image[(size_t)(y0+y) * m_iw + x0];
+                    bool edge = y == 0 || y == m_px-1;
+                    for(int x = 0; x < m_px; ++x)
+                        row[x] = edge || x == 0 || x == m_px-1 ? grid : col;
                 }
-                SDL_RenderFillRect(rend, &t);
-                SDL_SetRenderDrawColor(rend, 0x80, 0x80, 0x80, m_alpha); 
-                SDL_RenderDrawRect(rend, &t);
             }
         }
     }
 
-    void draw(Thing &p, drawContext &dc, int mw, int mh) {
-        SDL_Renderer *rend = dc.ren_ptr();
-        /* 
+    /* The map image, blended over the frame. */
+    void draw(drawContext &dc) {
+        int w = std::min(m_iw, (int)dc.SCREEN_WIDTH);
+        int h = std::min(m_ih, (int)dc.SCREEN_HEIGHT);
+        for(int y = 0; y < h; ++y)
+            dc.blendSpan(0, y, &m_image[(size_t)y * m_iw], w);
+    }
+
+    void draw(const Thing &p, drawContext &dc, int mh) {
+        /*
          * Entity's y is inverted as SDL's origin is top left.
          */
-        int xi = (int)p.x, yi = (int)p.y;
-        SDL_Rect pr = { 
-            (int)((p.x-p.w/2)*m_scale), 
-            (int)((mh-p.y-p.h/2)*m_scale), 
-            (int)(p.w*m_scale), 
-            (int)(p.h*m_scale),
-        };
-        SDL_SetRenderDrawColor(rend, 0xFF, 0xF2, 0x00, 0xFF); 
-        SDL_RenderFillRect(rend, &pr);
-        
+        __fillRect(dc,
+                   (int)((p.x-p.w/2)*m_px),
+                   (int)((mh-p.y-p.h/2)*m_px),
+                   (int)(p.w*m_px),
+                   (int)(p.h*m_px),
+                   0xFFFFF200);
+
         float lx = p.x+cos(p.a)*p.w;
         float ly = (mh-p.y)-sin(p.a)*p.h;
         float lw = p.w/2, lh = p.h/2;
-        SDL_Rect lr = { 
-            (int)((lx-lw/2)*m_scale), 
-            (int)((ly-lh/2)*m_scale), 
-            (int)(lw*m_scale), 
-            (int)(lh*m_scale),
-        };
-        SDL_SetRenderDrawColor(rend, 0xFF, 0x00, 0x00, 0xFF); 
-        SDL_RenderFillRect(rend, &lr);
+        __fillRect(dc,
+                   (int)((lx-lw/2)*m_px),
+                   (int)((ly-lh/2)*m_px),
+                   (int)(lw*m_px),
+                   (int)(lh*m_px),
+                   0xFFFF0000);
+    }
+
+    void drawLine(float x1, float y1, float x2, float y2,
+                  int R, int G, int B, const Map &m, drawContext &dc) {
+        __line(mmLine{ x1, y1, x2, y2,
+                       0xFF000000u | R << 16 | G << 8 | B }, m.h, dc);
     }
 
-    void drawLine(float x1, float y1, float x2, float y2, 
-                  int R, int G, int B, Map &m, drawContext &dc) {
-        SDL_Renderer *rend = dc.ren_ptr();
-        SDL_SetRenderDrawColor(rend, R, G, B, 255); 
-        SDL_RenderDrawLine(rend, 
-                           x1      *m_scale,
-                           (m.h-y1)*m_scale,
-                           x2      *m_scale, 
-                           (m.h-y2)*m_scale);
+    /* All of lines, as one batch. */
+    void drawLines(const std::vector<mmLine> &lines, const Map &m,
+                   drawContext &dc) {
+        for(const mmLine &l : lines)
+            __line(l, m.h, dc);
     }
+
+  private:
+    /* Bresenham, from map to minimap space. Lines are clipped to the
+     * frame first (Liang-Barsky), so long rays cost no more than the
+     * pixels they light. */
+    void __line(const mmLine &l, int mh, drawContext &dc) {
+        float x1 = l.x1*m_px, y1 = (mh-l.y1)*m_px;
+        float dxf = l.x2*m_px - x1, dyf = (mh-l.y2)*m_px - y1;
+        float t0 = 0, t1 = 1;
+        float p[4] = { -dxf, dxf, -dyf, dyf };
+        float q[4] = { x1, dc.SCREEN_WIDTH-1 - x1, y1, dc.SCREEN_HEIGHT-1 - y1 };
+        for(int k = 0; k < 4; ++k) {
+            if(p[k] == 0) {
+                if(q[k] < 0)
+                    return;
+                continue;
+            }
+            float t = q[k] / p[k];
+            if(p[k] < 0) t0 = std::max(t0, t);
+            else         t1 = std::min(t1, t);
+        }
+        if(t0 > t1)
+            return;
+
+        uint32_t col = l.col;
+        int x  = x1 + t0*dxf, y  = y1 + t0*dyf;
+        int xe = x1 + t1*dxf, ye = y1 + t1*dyf;
+        int dx = std::abs(xe-x), sx = x < xe ? 1 : -1;
+        int dy = -std::abs(ye-y), sy = y < ye ? 1 : -1;
+        int err = dx + dy;
+        for(;;) {
+            if(x >= 0 && x < dc.SCREEN_WIDTH && y >= 0 && y < dc.SCREEN_HEIGHT)
+                dc.writePixel<ALPHA_OPAQUE>(x, y, col);
+            if(x == xe && y == ye)
+                break;
+            int e2 = 2*err;
+            if(e2 >= dy) { err += dy; x += sx; }
+            if(e2 <= dx) { err += dx; y += sy; }
+        }
+    }
+
+    void __fillRect(drawContext &dc, int x, int y, int w, int h,
+                    uint32_t col) {
+        int x0 = std::max(x, 0), x1 = std::min(x+w, (int)dc.SCREEN_WIDTH);
+        int y0 = std::max(y, 0), y1 = std::min(y+h, (int)dc.SCREEN_HEIGHT);
+        for(int yy = y0; yy < y1; ++yy)
+            for(int xx = x0; xx < x1; ++xx)
+                dc.writePixel<ALPHA_OPAQUE>(xx, yy, col);
+    }
+
+    std::vector<uint32_t> m_image;
+    int m_px = 0;               // frame pixels a cell is wide
+    int m_iw = 0, m_ih = 0;
 };
 
 
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include <options.h>
+
+static bool read_int(const char *s, int &out)
+{
+    char *end = nullptr;
+    long v = std::strtol(s, &end, 10);
+    if(end == s || *end != '\0' || v < 0)
+        return false;
+    out = (int)v;
+    return true;
+}
+
+static bool read_float(const char *s, float &out)
+{
+    char *end = nullptr;
+    float v = std::strtof(s, &end);
+    if(end == s || *end != '\0' || !(v > 0))
+        return false;
+    out = v;
+    return true;
+}
+
+err_code parse_options(int argc, char **argv, options &opts)
+{
+    for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if( 0 == std::strcmp(arg, "--headless") ) {
+            opts.headless = true;
+        } else
+        if( 0 == std::strcmp(arg, "--frames") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.frames) ) {
+                std::cout << "--frames expects a non-negative number.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--dump") && i+1 < argc ) {
+            opts.dump_path = argv[++i];
+        } else
+        if( 0 == std::strcmp(arg, "--simd") && i+1 < argc ) {
+            const char *isa = argv[++i];
+            if     ( 0 == std::strcmp(isa, "auto")   ) opts.simd = SPAN_AUTO;
+            else if( 0 == std::strcmp(isa, "scalar") ) opts.simd = SPAN_SCALAR;
+            else if( 0 == std::strcmp(isa, "sse2")   ) opts.simd = SPAN_SSE2;
+            else if( 0 == std::strcmp(isa, "avx2")   ) opts.simd = SPAN_AVX2;
+            else {
+                std::cout << "--simd expects auto, scalar, sse2 or avx2.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--fov") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.fov) || opts.fov < 1 || opts.fov > 179 ) {
+                std::cout << "--fov expects degrees from 1 to 179.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--width") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.width) || opts.width < 1 ) {
+                std::cout << "--width expects a positive number.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--height") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.height) || opts.height < 1 ) {
+                std::cout << "--height expects a positive number.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--scale") && i+1 < argc ) {
+            if( !read_float(argv[++i], opts.scale) || opts.scale > 1 ) {
+                std::cout << "--scale expects a number in (0, 1].\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--no-mipmaps") ) {
+            opts.mipmaps = false;
+        } else
+        if( 0 == std::strcmp(arg, "--row-major-walls") ) {
+            opts.transposed_walls = false;
+        } else
+        if( 0 == std::strcmp(arg, "--profile-every") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.profile_every) ) {
+                std::cout << "--profile-every expects a non-negative number.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--trace") && i+1 < argc ) {
+            opts.trace_path = argv[++i];
+        } else
+        if( 0 == std::strcmp(arg, "--record") && i+1 < argc ) {
+            opts.record_path = argv[++i];
+        } else
+        if( 0 == std::strcmp(arg, "--replay") && i+1 < argc ) {
+            opts.replay_path = argv[++i];
+        } else
+        if( 0 == std::strcmp(arg, "--frame-times") && i+1 < argc ) {
+            opts.frame_times_path = argv[++i];
+        } else
+        if( 0 == std::strcmp(arg, "--upload") && i+1 < argc ) {
+            const char *how = argv[++i];
+            if     ( 0 == std::strcmp(how, "lock")   ) opts.upload = DC_UPLOAD_LOCK;
+            else if( 0 == std::strcmp(how, "update") ) opts.upload = DC_UPLOAD_UPDATE;
+            else {
+                std::cout << "--upload expects lock or update.\n";
+                return OPTIONS_WRONG;
+            }
+        } else
+        if( 0 == std::strcmp(arg, "--no-pipeline") ) {
+            opts.pipeline = false;
+        } else
+        if( 0 == std::strcmp(arg, "--threads") && i+1 < argc ) {
+            if( !read_int(argv[++i], opts.threads) ) {
+                std::cout << "--threads expects a non-negative number.\n";
+                return OPTIONS_WRONG;
+            }
+        } else {
+            std::cout << "Unknown option " << arg << ".\n"
+                      << "Usage: " << argv[0] 
+                      << " [--headless] [--frames N] [--dump file.ppm]"
+                      << " [--threads N] [--simd auto|scalar|sse2|avx2]"
+                      << " [--fov degrees] [--width W] [--height H]"
+                      << " [--scale S] [--no-mipmaps] [--row-major-walls]"
+                      << " [--no-pipeline] [--profile-every N]"
+                      << " [--trace file.json] [--record file.rpl]"
+                      << " [--replay file.rpl] [--frame-times file.csv]"
+                      << " [--upload lock|update]\n";
+            return OPTIONS_WRONG;
+        }
+    }
+    if(opts.dump_path && !opts.headless) {
+        std::cout << "--dump is only available with --headless.\n";
+        return OPTIONS_WRONG;
+    }
+    if(opts.record_path && opts.replay_path) {
+        std::cout << "--record and --replay cannot be used together.\n";
+        return OPTIONS_WRONG;
+    }
+    // Nobody could ever close a headless run, a replay ends by itself.
+    if(opts.headless && opts.frames == 0 && !opts.replay_path)
+        opts.frames = 1;
+    return NO_ERROR;
+}
@@ -0,0 +1,35 @@
+#ifndef OPTIONS_SENTRY
+#define OPTIONS_SENTRY
+
+
+#include <errors.h>
+#include "spans.h"
+#include "drawContext.h"
+
+
+struct options {
+    bool headless = false; // render into CPU memory, no window
+    int  frames   = 0;     // frames to render before exiting, 0 is forever
+    const char *dump_path = nullptr; // headless only: last frame as PPM
+    int  threads  = 1;     // render threads, 0 is one per core
+    SPAN_ISA simd = SPAN_AUTO;
+    int  fov      = 66;    // degrees
+    int  width    = 640;   // window size
+    int  height   = 480;
+    float scale   = 1;     // frames are rendered at window size * scale
+    bool mipmaps  = true;  // sample far textures from their mip levels
+    bool transposed_walls = true; // keep wall textures column major too
+    bool pipeline = true;  // render on a thread apart from presenting
+    int  profile_every = 0; // frames between profile reports, 0 is at exit
+    const char *trace_path = nullptr; // profiled zones as a Chrome trace
+    const char *record_path = nullptr; // ticks of this run as a replay
+    const char *replay_path = nullptr; // ticks to run instead of the keys
+    const char *frame_times_path = nullptr; // per frame times as CSV
+    DC_UPLOAD upload = DC_UPLOAD_LOCK; // how frames get into the texture
+};
+
+err_code 
+parse_options(int argc, char **argv, options &opts);
+
+
+#endif
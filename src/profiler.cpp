@@ -0,0 +1,108 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include <profiler.h>
+
+
+static const char *zone_names[PZ_COUNT] = {
+    "frame",
+    "simulate",
+    "ray setup",
+    "columns",
+    "dda",
+    "walls",
+    "floor/ceiling",
+    "sprites",
+    "minimap",
+    "present",
+};
+
+/* Threads are numbered as they first enter a zone. */
+static uint8_t
+prof_thread()
+{
+    static std::atomic<int> next {0};
+    thread_local uint8_t id = next.fetch_add(1);
+    return id;
+}
+
+profiler &prof(void)
+{
+    static profiler p;
+    return p;
+}
+
+void profiler::endFrame()
+{
+    prof_ns *row = m_hist[m_frames % PROF_FRAMES];
+    for(int z = 0; z < PZ_COUNT; ++z)
+        row[z] = m_acc[z].exchange(0, std::memory_order_relaxed);
+    ++m_frames;
+}
+
+void profiler::__event(PROF_ZONE z, prof_ns start, prof_ns end)
+{
+    uint64_t i = m_next_event.fetch_add(1, std::memory_order_relaxed);
+    profEvent &e = m_events[i % PROF_EVENTS];
+    e.start  = start;
+    e.dur    = end - start;
+    e.zone   = z;
+    e.thread = prof_thread();
+}
+
+void profiler::report(std::ostream &out) const
+{
+    size_t n = std::min<unsigned long long>(m_frames, PROF_FRAMES);
+    if(n == 0)
+        return;
+    std::vector<prof_ns> t(n);
+    auto ms = [](prof_ns ns){ return ns / 1e6; };
+    out << "Last " << n << " frames, ms"
+        << "          p50      p95      p99      max\n"
+        << std::fixed << std::setprecision(3);
+    for(int z = 0; z < PZ_COUNT; ++z) {
+        for(size_t f = 0; f < n; ++f)
+            t[f] = m_hist[f][z];
+        std::sort(t.begin(), t.end());
+        if(t[n-1] == 0)
+            continue; // never entered
+        out << "  " << std::left << std::setw(24) << zone_names[z]
+            << std::right
+            << std::setw(9) << ms(t[ n*50/100 ])
+            << std::setw(9) << ms(t[ n*95/100 ])
+            << std::setw(9) << ms(t[ n*99/100 ])
+            << std::setw(9) << ms(t[ n-1 ]) << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+err_code profiler::writeTrace(const char *path) const
+{
+    std::unique_ptr<FILE, int(*)(FILE *)> f { fopen(path, "w"), fclose };
+    if(!f) {
+#ifdef DEBUG
+        std::cout << "Couldn't write the trace into " << path << "\n";
+#endif
+        return TRACE_DUMP_FAIL;
+    }
+    uint64_t end   = m_next_event.load();
+    uint64_t begin = end > PROF_EVENTS ? end - PROF_EVENTS : 0;
+    prof_ns  t0    = begin < end ? m_events[begin % PROF_EVENTS].start : 0;
+    fprintf(f.get(), "{\"traceEvents\":[");
+    for(uint64_t i = begin; i < end; ++i) {
+        const profEvent &e = m_events[i % PROF_EVENTS];
+        // Timestamps are microseconds, from the oldest zone kept.
+        fprintf(f.get(),
+                "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                i == begin ? "" : ",", zone_names[e.zone], e.thread,
+                (double)(e.start - std::min(e.start, t0)) / 1e3,
+                e.dur / 1e3);
+    }
+    fprintf(f.get(), "\n]}\n");
+    return NO_ERROR;
+}
@@ -0,0 +1,130 @@
+#ifndef PROFILER_SENTRY
+#define PROFILER_SENTRY
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include <errors.h>
+
+
+/* Stages of a frame timed by the profiler. */
+enum PROF_ZONE : uint8_t {
+    PZ_FRAME,     // one turn of the main loop
+    PZ_SIMULATE,
+    PZ_RAY_SETUP, // camera, grid and pass setup in draw()
+    PZ_COLUMNS,   // a chunk of drawColumns(), its DDA and walls
+    PZ_DDA,       // summed over columns, no trace events
+    PZ_WALLS,     // summed over columns, no trace events
+    PZ_FLOOR,     // floor and ceiling rows
+    PZ_SPRITES,
+    PZ_MINIMAP,
+    PZ_PRESENT,
+    PZ_COUNT
+};
+
+// Frames kept for the percentiles, a power of two.
+#define PROF_FRAMES 1024
+// Zones kept for the trace, a power of two.
+#define PROF_EVENTS (1 << 16)
+
+
+using prof_ns = uint64_t;
+
+inline prof_ns
+prof_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+/* Per zone time of the last PROF_FRAMES frames and the last PROF_EVENTS
+ * zones entered. Zones may be timed by any thread, their time counts
+ * toward the frame being profiled when they end. Time of zones run by
+ * several threads at once is summed, so it is CPU time, not wall time. */
+class profiler {
+  public:
+    /* Adds ns to zone z of the frame being profiled. */
+    void add(PROF_ZONE z, prof_ns ns) {
+        m_acc[z].fetch_add(ns, std::memory_order_relaxed);
+    };
+
+    /* A zone from start to end on the calling thread. */
+    void zone(PROF_ZONE z, prof_ns start, prof_ns end) {
+        add(z, end - start);
+        if(m_tracing)
+            __event(z, start, end);
+    };
+
+    /* Closes the frame being profiled and starts the next one. */
+    void endFrame();
+
+    unsigned long long frames() const { return m_frames; };
+
+    /* Forgets every frame and zone so far. */
+    void reset() {
+        for(auto &acc : m_acc)
+            acc.store(0, std::memory_order_relaxed);
+        m_frames = 0;
+        m_next_event.store(0);
+    };
+
+    /* Zones are only kept for the trace while tracing. */
+    void setTracing(bool on) { m_tracing = on; };
+
+    /* p50, p95, p99 and max of every zone over the frames kept. */
+    void report(std::ostream &out) const;
+
+    /* Zones kept as a Chrome trace, see chrome://tracing. */
+    err_code writeTrace(const char *path) const;
+
+  private:
+    struct profEvent {
+        prof_ns start, dur;
+        PROF_ZONE zone;
+        uint8_t   thread;
+    };
+
+    void __event(PROF_ZONE z, prof_ns start, prof_ns end);
+
+    std::atomic<prof_ns>  m_acc[PZ_COUNT] {};
+    prof_ns               m_hist[PROF_FRAMES][PZ_COUNT] {};
+    unsigned long long    m_frames = 0;
+
+    bool                  m_tracing = false;
+    profEvent             m_events[PROF_EVENTS] {};
+    std::atomic<uint64_t> m_next_event {0};
+};
+
+/* The one profiler of the game. */
+profiler &prof(void);
+
+
+/* Times the scope it lives in as zone z. */
+class profZone {
+  public:
+    profZone(PROF_ZONE z) : m_zone(z), m_start(prof_now()) {};
+    ~profZone() { prof().zone(m_zone, m_start, prof_now()); };
+
+    profZone(const profZone &other)            = delete;
+    profZone &operator=(const profZone &other) = delete;
+
+  private:
+    PROF_ZONE m_zone;
+    prof_ns   m_start;
+};
+
+/* Zones cost nothing unless the build profiles. */
+#ifdef BENCH_RENDER
+#define PROF_CAT_(a, b) a##b
+#define PROF_CAT(a, b) PROF_CAT_(a, b)
+#define PROF_ZONE(z) profZone PROF_CAT(prof_zone_, __LINE__) {z}
+#else
+#define PROF_ZONE(z)
+#endif
+
+
+#endif
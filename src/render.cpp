@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <algorithm>
+#include <vector>
 
 #include "render.h"
 #include "things.h"
@@ -9,70 +10,154 @@
 #include "linal.h"
 #include "tileMap.h"
 #include "guard.h"
+#include "renderPool.h"
+#include "camera.h"
+#include "profiler.h"
+#include "debugLog.h"
 
 
 enum WALL_HIT {
     WH_NONE, WH_HORIZONTAL, WH_VERTICAL,
 };
 
-void
-draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff)
-{
-    dc.lock();
-    auto unlocker = [&dc](){ dc.unlock(); };
-    auto unlock_guard = make_simple_guard(unlocker);
-
-    Thing   &p      = sc.p;
-    Things  &things = sc.things;
-    Map     &map    = sc.m;
-    miniMap &mm     = sc.mm;
+/* Walk down a wall texture column, one screen pixel at a time. 
+ * Texture rows wrap at th, with a mask when POT says th is a power of 
+ * two and with a compare otherwise. */
+template<bool POT>
+struct wallWalk {
+    int ty;
+    int th;
+    int y_inc;
+    int accum;
+    int d;
+    int threshold;
+    int thres_inc;
+
+    void step() {
+        accum += d;
+        if(accum >= threshold) {
+            ty += y_inc;
+            if(POT)
+                ty &= th - 1;
+            else
+            if(ty >= th) ty -= th;
+            else
+            if(ty < 0)   ty += th;
+            threshold += thres_inc;
+        }
+    }
+};
 
-    auto z_buffer   = buff.z;
-    auto things_dst = buff.things_dst; 
-    auto things_ids = buff.things_ids; 
+/* Texels of one wall are all of the same alpha class K, so the way they
+ * are written is chosen once per column. The texture column comes from 
+ * tileMap::column(), texel ty of it is column[ty*step]. */
+template<ALPHA_CLASS K, bool POT>
+static void
+drawWallSpan(drawContext &dc, int i, const uint32_t *column, int step,
+             wallWalk<POT> w, int line_start, int line_end)
+{
+    for(int y = line_start; y < line_end; ++y) {
+        /*
+        rgb = tm.getColorRGB(wall_t, tx, ty);
+        dc.setPixel(dc.SCREEN_WIDTH-i, dc.SCREEN_HEIGHT-y,
+                    rgb.r, rgb.g, rgb.b, 255); 
+        */
+        dc.writePixel<K>(i, dc.SCREEN_HEIGHT-1-y, column[w.ty*step]);
+        w.step();
+    }
+}
 
-    float fov       = 1.15192; // 66 degrees
-    float h_fov_tan = tan(fov/2);
-#ifdef FAST_DDA
-    // pdirl should be 1 as computation of perpDist below relies on it.
-    float pdirl = 1;
-#else
-    // pdirl can be any number as perpDist is computed via dot product.
-    float pdirl = 1;
-#endif
-    float pdirx = pdirl*cos(p.a), pdiry = pdirl*sin(p.a);
-    // Camera
-    float cdirl = h_fov_tan * pdirl;
-    float cdirx = -pdiry/pdirl*cdirl, cdiry = pdirx/pdirl*cdirl;
+/* One wall column from line_b to line_t, clipped to the screen, th texels
+ * tall. Returns the first row drawn. */
+template<bool POT>
+static int
+drawWall(drawContext &dc, int i, ALPHA_CLASS k, const uint32_t *column, 
+         int step, int th, int line_h, int line_b, int line_t)
+{
+    /* It uses the abridged version of Bresenham's integer line algorithm.
+     * I presume here that th will never be >= line_h. */
+   
+    int m = th; // rise / run * run, see below
+    wallWalk<POT> w;
+    w.ty        = 0;
+    w.th        = th;
+    w.y_inc     = m >= 0 ? 1 : -1;
+    w.accum     = 0;
+    w.d         = std::abs(m) * 2;   //slope * 2 * run
+    w.threshold = line_h;            //0.5   * 2 * run
+    w.thres_inc = 2 * line_h;        //1.0   * 2 * run
+
+    int line_start = line_b;
+    int line_end   = line_t;
+    if(line_start < 0) { 
+        for(int i = 0; i < std::abs(line_start); ++i)
+            w.step();
+        line_start = 0;
+    } 
+    if(line_end > dc.SCREEN_HEIGHT) {
+        line_end = dc.SCREEN_HEIGHT;
+    }
+    switch(k) {
+        case(ALPHA_OPAQUE):
+            drawWallSpan<ALPHA_OPAQUE>(dc, i, column, step, w, 
+                                       line_start, line_end);
+            break;
+        case(ALPHA_KEYED):
+            drawWallSpan<ALPHA_KEYED>(dc, i, column, step, w, 
+                                      line_start, line_end);
+            break;
+        default:
+            drawWallSpan<ALPHA_TRANSLUCENT>(dc, i, column, step, w, 
+                                            line_start, line_end);
+            break;
+    }
+    return line_start;
+}
 
+/* Per frame state shared by every column and row. Columns only read it, 
+ * and each writes its own framebuffer column and z_buffer cell, so any 
+ * split of [0, SCREEN_WIDTH) between threads renders the very same frame.
+ * The same holds for floor rows. */
+struct framePass {
+    Thing       &p;
+    Map         &map;
+    tileMap     &tm;
+    drawContext &dc;
+    camera      &cam;
+    thingGrid   &grid;
+    float       *z_buffer;
+    int         *floor_h;
 #ifdef DEBUG
-    mm.drawLine(p.x, p.y, p.x+pdirx, p.y+pdiry, 0x00, 0xFF, 0x00, map, dc); 
-    mm.drawLine(p.x, p.y, p.x+cdirx, p.y+cdiry, 0xFF, 0x00, 0x00, map, dc); 
+    WALL_HIT    *hits;
 #endif
+};
 
-    // Walls, floor, ceiling.
-    for(int i = 0; i < dc.SCREEN_WIDTH; i++) {
-        // Cofficient for camera vector, from 1 to -1.
-        // (cdir is 90d to the left of pdir).
-        float cc = -(2.0*(float)i/(float)dc.SCREEN_WIDTH - 1.0); 
-        float rdirx = pdirx+cdirx*cc;
-        float rdiry = pdiry+cdiry*cc;
-
-        // The main question is how much x and y contribute to ray length.
-        // So below is change in len of ray for each 1 unit change in x or y.
-#ifdef FAST_DDA
-        // In fact, instead of computing exactly the length of ray for one
-        // unit of x or y, we can do the same with just the ratios.
-        float rxtl_ratio = rdirx == 0 ? 1e30 : std::abs(1 / rdirx);
-        float rytl_ratio = rdiry == 0 ? 1e30 : std::abs(1 / rdiry);
-#else
-        /*
-        float rxtl_ratio = std::sqrt(1+(rdiry*rdiry)/(rdirx*rdirx));
-        float rytl_ratio = std::sqrt(1+(rdirx*rdirx)/(rdiry*rdiry));
-        */
-        float rdirl = std::sqrt( dot(rdirx, rdiry, rdirx, rdiry) );
-        float rxtl_ratio = rdirx == 0 ? 1e30 : std::abs(rdirl / rdirx);
-        float rytl_ratio = rdiry == 0 ? 1e30 : std::abs(rdirl / rdiry);
+static void
+drawColumns(framePass &cp, int begin, int end)
+{
+    Thing       &p        = cp.p;
+    Map         &map      = cp.map;
+    drawContext &dc       = cp.dc;
+    float       *z_buffer = cp.z_buffer;
+    camera      &cam      = cp.cam;
+
+    // Cells the rays went through, things in them may be visible.
+    std::vector<int> seen;
+    seen.reserve(4 * (end - begin));
+
+    PROF_ZONE(PZ_COLUMNS);
+#ifdef BENCH_RENDER
+    // Per column zones would cost more than the columns, so the time of
+    // each part is summed over the chunk.
+    prof_ns t_dda = 0, t_walls = 0, t_col = prof_now(), t_hit = 0;
+#endif
+    for(int i = begin; i < end; i++) {
+        float rdirx      = cam.rdirx[i];
+        float rdiry      = cam.rdiry[i];
+        float rxtl_ratio = cam.rxtl_ratio[i];
+        float rytl_ratio = cam.rytl_ratio[i];
+#ifndef FAST_DDA
+        float rdirl      = cam.rdirl[i];
 #endif
 
         // And this is a ray length from start to next hit x or y.
@@ -86,8 +171,6 @@ draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff)
 
         WALL_HIT wh = WH_NONE;
 
-        int maxgridl = 100;
-        int curmaxgridl = 0;
         // Calculate initial conditions.
         if(rdirx < 0) {
             gridstepx = -1;
@@ -104,19 +187,25 @@ draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff)
             rdirly = ((gridy+1.0) - p.y) * rytl_ratio;
         }
 
+        /* The map border is solid, so the walk needs no bounds checks and
+         * no length limit, and it steps through cells by index alone. */
+        const mapCell *cells = map.cells();
+        int cellstepx =  gridstepx;
+        int cellstepy = -gridstepy * map.stride();
+        int cell_i    = map.cellIndex(gridx, gridy);
+        seen.push_back(cell_i);
         do {
             if(rdirlx < rdirly) {
                 rdirlx += rxtl_ratio;
-                gridx  += gridstepx;
+                cell_i += cellstepx;
                 wh = WH_VERTICAL;
-                curmaxgridl = std::abs(gridx-p.x);
             } else {
                 rdirly += rytl_ratio;
-                gridy  += gridstepy;
+                cell_i += cellstepy;
                 wh = WH_HORIZONTAL;
-                curmaxgridl = std::abs(gridy-p.y);
             }
-        } while (!map.isWall(gridx, gridy) && curmaxgridl < maxgridl);
+            seen.push_back(cell_i);
+        } while (cells[cell_i].coll != WALL);
 
         float perpDist = 0;
         float whc_n = 0; //wall hit coordinate normalized
@@ -152,25 +241,32 @@ draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff)
         };
         z_buffer[i] = perpDist;
         whc_n -= std::floor(whc_n); //TODO test just casting into int
+#ifdef BENCH_RENDER
+        t_hit  = prof_now();
+        t_dda += t_hit - t_col;
+#endif
 
         /* The problem of perpDist being < 1 and the line_h > SCREEN_HEIGHT
          * is handled further below. */
         int line_h = dc.SCREEN_HEIGHT / perpDist;
         int line_b = dc.SCREEN_HEIGHT/2 - line_h/2;
-        int line_t = dc.SCREEN_HEIGHT/2 + line_h/2;
+        // Ceiling rows are the floor rows mirrored, so the wall is too, 
+        // and the three tile the column whatever the parity of the height.
+        int line_t = dc.SCREEN_HEIGHT - line_b;
 #ifdef DEBUG
         if(perpDist < 1.0)
-            std::cout << "perpDist < 1.0 " << perpDist << std::endl;
+            DEBUG_LOG("perpDist < 1.0 %f", perpDist);
 #endif
 
 #ifndef NO_RENDER_TEX
         // Walls
+        tileMap &tm = cp.tm;
         int tx = 0;
-        int ty = 0;
-        int tw = tm.m_tw;
-        int th = tm.m_th;
-        int wall_t = map.getWall(gridx, gridy);
-        int mask = th - 1;
+        // Screen pixels of far walls are more than a texel apart.
+        int level = tm.mipLevel(tm.m_th * perpDist / dc.SCREEN_HEIGHT);
+        int tw = tm.m_tw >> level;
+        int th = tm.m_th >> level;
+        int wall_t = cells[cell_i].wall;
 
         tx = (whc_n * (float)tw);
         // In below cases ray approaches tile from its top.
@@ -178,226 +274,422 @@ draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff)
         else
         if(wh == WH_HORIZONTAL && rdiry < 0) tx = tw-1-tx;;
        
-        /* It uses the abridged version of Bresenham's integer line algorithm.
-         * I presume here that th will never be >= line_h. */
-       
-        int m = th; // rise / run * run, see below
-        int y_inc = m >= 0 ? 1 : -1;
-        int accum = 0;
-        int d = std::abs(m) * 2;         //slope * 2 * run
-        int threshold = line_h;          //0.5   * 2 * run
-        int thres_inc = 2 * line_h;      //1.0   * 2 * run
-
-        int line_start = line_b;
-        int line_end   = line_t;
-        if(line_start < 0) { 
-            for(int i = 0; i < std::abs(line_start); ++i) {
-                accum += d;
-                if(accum >= threshold) {
-                    ty += y_inc;
-                    ty &= mask;
-                    threshold += thres_inc;
-                }
-            }
-            line_start = 0;
-        } 
-        if(line_end > dc.SCREEN_HEIGHT) {
-            line_end = dc.SCREEN_HEIGHT;
-        }
-        for(int y = line_start; y < line_end; ++y) {
-            /*
-            rgb = tm.getColorRGB(wall_t, tx, ty);
-            dc.setPixel(dc.SCREEN_WIDTH-i, dc.SCREEN_HEIGHT-y,
-                        rgb.r, rgb.g, rgb.b, 255); 
-            */
-            dc.setPixel(i, dc.SCREEN_HEIGHT-1-y,
-                        tm.getColor(wall_t, tx, ty) );
-            accum += d;
-            if(accum >= threshold) {
-                ty += y_inc;
-                ty &= mask;
-                threshold += thres_inc;
-            }
-        }
+        int step = 0;
+        const uint32_t *column = tm.column(wall_t, tx, level, step);
+        ALPHA_CLASS k = tm.alphaClass(wall_t);
+        int line_start = tm.pot() 
+            ? drawWall<true >(dc, i, k, column, step, th, line_h, line_b, line_t)
+            : drawWall<false>(dc, i, k, column, step, th, line_h, line_b, line_t);
 
-        /* Floor and ceiling. 
-         * At the same time as bigZ is in the middle of the screen and 
-         * they are symmetrical. */
-        float bigZ = (float)dc.SCREEN_HEIGHT / 2;
-        for(int y = 0; y < line_start; ++y) {
-            float smallZ  = bigZ - y;     
-
-#ifdef FAST_DDA
-            /* pdirl/row_dist = smallZ/bigZ */
-            // Here pdirl == 1 in every case.
-            float row_dist = bigZ/smallZ;  
-#else
-            /* pdirl is included as normalizing coefficient for rdirl that is 
-             * used later, not as a part of the ratio formula! */
-            float row_dist = bigZ/smallZ/pdirl; 
-#endif
-
-            /* Imagine a right triangle with pdir and rdir as sides. 
-             * Both hit the imaginary screen while rdir also goes though
-             * pixel being colored (well, its projection to the ground).
-             * If all the sides are multiplied by row_dist, then 
-             * the resulting triangle is similar to original one and 
-             * resulting ray is hitting the floor/wall in a correct sample spot 
-             */
-            float f_tilex = p.x + rdirx * row_dist;
-            float f_tiley = p.y + rdiry * row_dist; 
-
-            int tile_x = f_tilex;
-            int tile_y = f_tiley;
-            
-            int tx = (int)(tw * (f_tilex - tile_x) ) & (tw-1);
-            int ty = (int)(th * (f_tiley - tile_y) ) & (th-1); 
-
-            int floor_t = map.getFloor(tile_x, tile_y);
-            /*
-            rgb = tm.getColorRGB(floor_t, tx, ty);
-            dc.setPixel(dc.SCREEN_WIDTH-i, dc.SCREEN_HEIGHT-y,
-                        rgb.r, rgb.g, rgb.b, 255); 
-            */
-            dc.setPixel(i, dc.SCREEN_HEIGHT-y-1,
-                        tm.getColor(floor_t, tx, ty) );
-
-            int ceil_t  = map.getCeil(tile_x, tile_y);
-            /*
-            rgb = tm.getColorRGB(ceil_t, tx, ty);
-            dc.setPixel(dc.SCREEN_WIDTH-i, y,
-                        rgb.r, rgb.g, rgb.b, 255); 
-            */
-            dc.setPixel(i, y,
-                        tm.getColor(ceil_t, tx, ty) );
-        }
+        /* Floor and ceiling are drawn row by row by drawFloorRows(),
+         * everything below line_start is theirs. */
+        cp.floor_h[i] = line_start;
 
 #else
         SDL_Renderer *rend = dc.ren_ptr();
-        SDL_SetRenderDrawColor(rend, 0x00, 0x00, 0xFF, 255); 
-        SDL_RenderDrawLine(rend, dc.SCREEN_WIDTH-i, line_b, dc.SCREEN_WIDTH-i, line_t);
+        if(rend) {
+            SDL_SetRenderDrawColor(rend, 0x00, 0x00, 0xFF, 255); 
+            SDL_RenderDrawLine(rend, dc.SCREEN_WIDTH-i, line_b, dc.SCREEN_WIDTH-i, line_t);
+        }
 #endif
 
 
 #ifdef DEBUG
-        int mm_ray_r = wh == WH_VERTICAL ? 0x00 : 0xFF;
-        // Normalization factor to rdirx and rdiry is included in perpDist!
-        mm.drawLine(p.x, p.y, 
-                    p.x+rdirx*perpDist, p.y+rdiry*perpDist, 
-                    mm_ray_r, 0xFF, 0xFF, map, dc); 
+        // SDL is not thread safe, the ray is drawn by draw() later on.
+        cp.hits[i] = wh;
 #endif
 
-    } //end drawing walls, floor, ceiling.
-
-    // Sprites
-    size_t th_size = things.size();
-    float tmpX = 0;
-    float tmpY = 0;
-    // Buffers's sizes are kept in sync with no of things by the app.
-    for(size_t i = 0; i < th_size; ++i) {
-        tmpX = p.x - things[i].x;
-        tmpY = p.y - things[i].y;
-        things_dst[i] = dot(tmpX, tmpY, tmpX, tmpY); //norm would do too.
-        things_ids[i] = i;
+#ifdef BENCH_RENDER
+        t_col    = prof_now();
+        t_walls += t_col - t_hit;
+#endif
     }
-    std::sort(
-        things_ids.begin(), 
-        //size is always == capacity.
-        things_ids.begin() + th_size,        
-        [&](int a, int b) { return std::isgreater(things_dst[a], things_dst[b]); } 
-    );
+#ifdef BENCH_RENDER
+    prof().add(PZ_DDA,   t_dda);
+    prof().add(PZ_WALLS, t_walls);
+#endif
+    cp.grid.see(seen);
+}
 
-    float inv_det = 1.0 / (cdirx * pdiry - pdirx * cdiry);
-    for(int i = 0; i < th_size; ++i) {
-        Thing &thing = things[ things_ids[i] ];
-        // calculating thing position relative to [cdir, pdir] space.
-        float tmp_x = thing.x - p.x;
-        float tmp_y = thing.y - p.y;
-        float th_x = inv_det * (tmp_x * pdiry - tmp_y * pdirx); 
-        float th_y = inv_det * (tmp_y * cdirx - tmp_x * cdiry); 
-        float a_th_y = std::abs(th_y);
-
-        if(th_y < 0)
-            continue;
-
-        int th_h = dc.SCREEN_HEIGHT / a_th_y;
-        int th_w = th_h; // because it's a square!
-
-        // If th_x/th_y > 1 -> thing's center is beyond FOV.
-        // Division also projects.
-        int thing_center_screen_x = dc.SCREEN_WIDTH / 2 - 
-            ((dc.SCREEN_WIDTH/2) * th_x/a_th_y);
-        int thing_center_screen_y = dc.SCREEN_HEIGHT / 2; 
-   
-        int hor_off = 0;
-        int hor_start = thing_center_screen_x - th_w/2; 
-        if(hor_start < 0) { hor_off = -hor_start; hor_start = 0; }
-        int hor_end   = thing_center_screen_x + th_w/2;
-        if(hor_end >= dc.SCREEN_WIDTH) hor_end = dc.SCREEN_WIDTH - 1;
-
-        int ver_off = 0;
-        int ver_start = thing_center_screen_y - th_h/2;
-        if(ver_start < 0) { ver_off = -ver_start; ver_start = 0; }
-        int ver_end   = thing_center_screen_y + th_h/2;
-        if(ver_end >= dc.SCREEN_HEIGHT) ver_end = dc.SCREEN_HEIGHT - 1;
-
-        auto sprite = thing.sprite;
-        int th = sprite->m_th;
-        int tw = sprite->m_tw;
-
-        /* This algo seems to be slightly more performant than Bresenham's */
-        int hor_off_ratio = hor_off * tw / th_w;
-        int ver_off_ratio = ver_off * tw / th_w;
-        for(int row = hor_start; row < hor_end; ++row) {
-            if( th_y >= z_buffer[row] )
-                continue;
-            // roses are red, float math is bad.
-            int tx = int(256*((row-hor_start) * tw/th_w))/256 + hor_off_ratio;
-            for(int col = ver_start; col < ver_end; ++col) {
-                int ty = int(256*(col-ver_start) * th/th_h)/256 + ver_off_ratio;
-                dc.setPixel( row, col, sprite->getColor(0, tx, ty) );
+#ifndef NO_RENDER_TEX
+/* Floor and ceiling, one screen row of each at a time. 
+ * At the same time as bigZ is in the middle of the screen and 
+ * they are symmetrical. Along a row the distance to the floor is constant,
+ * so only the sample spot moves, and it moves linearly with the column. 
+ * Texel coordinates wrap with a mask when POT says tiles are a power of
+ * two, and are clamped otherwise. */
+template<bool POT>
+static void
+drawFloorRows(framePass &fp, int begin, int end)
+{
+    Thing       &p     = fp.p;
+    Map         &map   = fp.map;
+    tileMap     &tm    = fp.tm;
+    drawContext &dc    = fp.dc;
+    int         *floor_h = fp.floor_h;
+    int sw = dc.SCREEN_WIDTH;
+
+    // Ray of the leftmost column (cc == 1) and its change per column.
+    camera      &cam   = fp.cam;
+    float rdirx0 = cam.pdirx + cam.cdirx;
+    float rdiry0 = cam.pdiry + cam.cdiry;
+    float rstepx = -2.0f * cam.cdirx / (float)sw;
+    float rstepy = -2.0f * cam.cdiry / (float)sw;
+    float rstepl = std::sqrt( dot(rstepx, rstepy, rstepx, rstepy) );
+
+    // Texels of a row are gathered here and then written as spans.
+    std::vector<uint32_t> floor_line(sw);
+    std::vector<uint32_t> ceil_line (sw);
+
+    float bigZ = (float)dc.SCREEN_HEIGHT / 2;
+    for(int y = begin; y < end; ++y) {
+        float smallZ  = bigZ - y;     
+
+#ifdef FAST_DDA
+        /* pdirl/row_dist = smallZ/bigZ */
+        // Here pdirl == 1 in every case.
+        float row_dist = bigZ/smallZ;  
+#else
+        /* pdirl is included as normalizing coefficient for rdirl that is 
+         * used later, not as a part of the ratio formula! */
+        float row_dist = bigZ/smallZ/cam.pdirl; 
+#endif
+
+        /* Imagine a right triangle with pdir and rdir as sides. 
+         * Both hit the imaginary screen while rdir also goes though
+         * pixel being colored (well, its projection to the ground).
+         * If all the sides are multiplied by row_dist, then 
+         * the resulting triangle is similar to original one and 
+         * resulting ray is hitting the floor/wall in a correct sample spot 
+         */
+        float f_tilex0 = p.x + rdirx0 * row_dist;
+        float f_tiley0 = p.y + rdiry0 * row_dist; 
+        float f_stepx  = rstepx * row_dist;
+        float f_stepy  = rstepy * row_dist;
+
+        // Neighbouring columns sample the floor f_step apart.
+        int level = tm.mipLevel(tm.m_tw * rstepl * row_dist);
+        int tw = tm.m_tw >> level;
+        int th = tm.m_th >> level;
+
+        int floor_y = dc.SCREEN_HEIGHT-y-1;
+        for(int i = 0; i < sw; ) {
+            if(y >= floor_h[i]) { 
+                ++i; 
+                continue; 
             }
-        }
+            // A run of columns whose floor reaches this row.
+            int run = i;
+            ALPHA_CLASS floor_k = ALPHA_OPAQUE;
+            ALPHA_CLASS ceil_k  = ALPHA_OPAQUE;
+            for(; i < sw && y < floor_h[i]; ++i) {
+                // Not accumulated, so the error does not grow along the row.
+                float f_tilex = f_tilex0 + f_stepx * i;
+                float f_tiley = f_tiley0 + f_stepy * i;
+
+                int tile_x = f_tilex;
+                int tile_y = f_tiley;
+                
+                int tx = (int)(tw * (f_tilex - tile_x) );
+                int ty = (int)(th * (f_tiley - tile_y) ); 
+                if(POT) {
+                    tx &= tw-1;
+                    ty &= th-1;
+                } else {
+                    tx = std::min(std::max(tx, 0), tw-1);
+                    ty = std::min(std::max(ty, 0), th-1);
+                }
 
-        /*
-        int tx = 0;
-        int ty = 0;
-        int mask = th - 1;
-        int m = th; // rise / run * run, see below
-        int y_inc = m >= 0 ? 1 : -1;
-        int accum = 0;
-        int d = std::abs(m) * 2;       //slope * 2 * run
-        int threshold = th_h;          //0.5   * 2 * run
-        int thres_inc = 2 * th_h;      //1.0   * 2 * run
-
-        if(ver_start < 0) { 
-            for(int i = 0; i < std::abs(ver_start); ++i) {
-                accum += d;
-                if(accum >= threshold) {
-                    ty += y_inc;
-                    ty &= mask;
-                    threshold += thres_inc;
+                // One cell holds both, and it is checked only once.
+                int floor_t = OUT_OF_BOUNDS;
+                int ceil_t  = OUT_OF_BOUNDS;
+                if(map.isWithin(tile_x, tile_y)) {
+                    const mapCell &c = map.cell(tile_x, tile_y);
+                    floor_t = c.floor;
+                    ceil_t  = c.ceil;
                 }
+                floor_line[i-run] = tm.getColor(floor_t, tx, ty, level);
+                floor_k = std::max(floor_k, tm.alphaClass(floor_t));
+
+                ceil_line [i-run] = tm.getColor(ceil_t, tx, ty, level);
+                ceil_k  = std::max(ceil_k,  tm.alphaClass(ceil_t));
             }
-            ver_start = 0;
-        } 
-        if(ver_end > dc.SCREEN_HEIGHT) {
-            ver_end = dc.SCREEN_HEIGHT;
+            dc.writeSpan(floor_k, run, floor_y, floor_line.data(), i-run);
+            dc.writeSpan(ceil_k,  run, y,       ceil_line.data(),  i-run);
         }
-        for(int y = ver_start; y < ver_end; ++y) {
-            for(int x = hor_start; x < hor_end; ++x) {
-                if(x < 0 || x >= dc.SCREEN_WIDTH || th_y > z_buffer[x])
-                    continue;
-                int tx = int(256*(x-hor_start) * tw/th_w)/256;
-                dc.setPixel(x, y, sprite->getColor(0, tx, ty) );
+    }
+}
+#endif
+
+/* Sprites are tested against z_buffer a block of columns at a time 
+ * first, only blocks with walls both in front and behind a sprite are 
+ * tested column by column. */
+#define SPRITE_ZBLOCK 16
+
+/* Per frame state of the sprite pass and buffers reused by every sprite. */
+struct spriteFrame {
+    const float          *z_buffer;
+    std::vector<float>    z_min;   // per block of SPRITE_ZBLOCK columns
+    std::vector<float>    z_max;
+    std::vector<int>      runs;    // visible columns, [begin, end) pairs
+    std::vector<int>      tx;      // texture column of a screen column
+    std::vector<uint32_t> line;
+    // Per slot of a visible thing, position relative to the player.
+    std::vector<float>    rel_x;
+    std::vector<float>    rel_y;
+    // Per visible thing, in the order drawn, in [cdir, pdir] space.
+    std::vector<float>    th_x;
+    std::vector<float>    th_y;
+
+    void init(const float *z, int sw) {
+        z_buffer = z;
+        int blocks = (sw + SPRITE_ZBLOCK-1) / SPRITE_ZBLOCK;
+        z_min.assign(blocks,  1e30);
+        z_max.assign(blocks, -1e30);
+        for(int x = 0; x < sw; ++x) {
+            int b = x / SPRITE_ZBLOCK;
+            z_min[b] = std::min(z_min[b], z[x]);
+            z_max[b] = std::max(z_max[b], z[x]);
+        }
+        tx.resize(sw);
+        line.resize(sw);
+    }
+
+    /* Picks positions of things in slots out of the arrays, alpha of the
+     * way from the previous to the last tick, so passes over visible 
+     * things run over plain arrays. They are kept by slot, so they stay
+     * valid once the slots are sorted. */
+    void gather(const Things &things, const std::vector<int> &slots,
+                float alpha, float px, float py) {
+        rel_x.resize(things.slots()); rel_y.resize(things.slots());
+        th_x.resize(slots.size());    th_y.resize(slots.size());
+        for(int s : slots) {
+            int t = things.denseOfSlot(s);
+            rel_x[s] = things.px[t] + (things.x[t]-things.px[t])*alpha - px;
+            rel_y[s] = things.py[t] + (things.y[t]-things.py[t])*alpha - py;
+        }
+    }
+
+    /* Finds the runs of [x0, x1) where depth is in front of the walls. */
+    void findRuns(float depth, int x0, int x1) {
+        runs.clear();
+        int run = -1;
+        for(int x = x0; x < x1; ) {
+            int b    = x / SPRITE_ZBLOCK;
+            int bend = std::min(x1, (b+1) * SPRITE_ZBLOCK);
+            if(depth >= z_max[b] || depth < z_min[b]) {
+                // The whole block is hidden or the whole block is visible.
+                bool visible = depth < z_min[b];
+                if(visible && run < 0)
+                    run = x;
+                if(!visible && run >= 0) {
+                    runs.push_back(run); runs.push_back(x);
+                    run = -1;
+                }
+                x = bend;
+                continue;
             }
-            accum += d;
-            if(accum >= threshold) {
-                ty += y_inc;
-                ty &= mask;
-                threshold += thres_inc;
+            for(; x < bend; ++x) {
+                bool visible = depth < z_buffer[x];
+                if(visible && run < 0)
+                    run = x;
+                if(!visible && run >= 0) {
+                    runs.push_back(run); runs.push_back(x);
+                    run = -1;
+                }
             }
         }
-        */
+        if(run >= 0) {
+            runs.push_back(run); runs.push_back(x1);
+        }
     }
+};
+
+/* Tile t_no of sprite for a thing standing th_y ahead of the player and 
+ * th_x to the side of it, both in [cdir, pdir] space. Anything behind the player, off
+ * the screen or behind the walls is left before a single texel is read.
+ * Texture coordinates are stepped in 16.16 fixed point. */
+static void
+drawSprite(drawContext &dc, spriteFrame &sf, tileMap *sprite, int t_no,
+           float th_x, float th_y)
+{
+    int sw = dc.SCREEN_WIDTH;
+    int sh = dc.SCREEN_HEIGHT;
+    // Behind the player, or so close it would be 16 screens tall.
+    if(!sprite || th_y <= 0 || sh / th_y > 16 * sh)
+        return;
+
+    int size = sh / th_y; // because it's a square!
+    if(size < 1)
+        return;
+    // If th_x/th_y > 1 -> thing's center is beyond FOV.
+    // Division also projects.
+    int center_x = sw / 2 - (sw / 2) * th_x / th_y;
+    int x0 = center_x - size / 2, x1 = x0 + size;
+    int y0 = sh / 2   - size / 2, y1 = y0 + size;
+    if(x1 <= 0 || x0 >= sw)
+        return;
+    int cx0 = std::max(x0, 0), cx1 = std::min(x1, sw);
+    int cy0 = std::max(y0, 0), cy1 = std::min(y1, sh);
+
+    sf.findRuns(th_y, cx0, cx1);
+    if(sf.runs.empty())
+        return;
+
+    int level = sprite->mipLevel( (float)sprite->m_tw / size );
+    const uint32_t *texels = sprite->tile(t_no, level);
+    if(!texels)
+        return; // it would be transparent black anyway
+    int tw = sprite->m_tw >> level;
+    int th = sprite->m_th >> level;
+    ALPHA_CLASS k = sprite->alphaClass(t_no);
+
+    int u_step = (tw << 16) / size;
+    int v_step = (th << 16) / size;
+    for(size_t r = 0; r < sf.runs.size(); r += 2)
+        for(int x = sf.runs[r]; x < sf.runs[r+1]; ++x)
+            sf.tx[x] = std::min( ((x - x0) * u_step) >> 16, tw-1 );
+
+    int v = (cy0 - y0) * v_step;
+    for(int y = cy0; y < cy1; ++y, v += v_step) {
+        const uint32_t *row = texels + tw * std::min(v >> 16, th-1);
+        // A run of visible columns is written as one span.
+        for(size_t r = 0; r < sf.runs.size(); r += 2) {
+            int begin = sf.runs[r], end = sf.runs[r+1];
+            for(int x = begin; x < end; ++x)
+                sf.line[x-begin] = row[ sf.tx[x] ];
+            dc.writeSpan(k, begin, y, sf.line.data(), end-begin);
+        }
+    }
+}
+
+void
+draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff,
+     renderPool *pool)
+{
+    dc.lock();
+    // Unlocking uploads the frame.
+    auto unlocker = [&dc](){ PROF_ZONE(PZ_PRESENT); dc.unlock(); };
+    auto unlock_guard = make_simple_guard(unlocker);
+
+    Thing   &p      = sc.p;
+    Things  &things = sc.things;
+    Map     &map    = sc.m;
+    miniMap &mm     = sc.mm;
+
+    auto z_buffer   = buff.z;
+    auto &things_dst = buff.things_dst; 
+    auto &order      = buff.things_order; 
+
+#ifdef BENCH_RENDER
+    prof_ns t_setup = prof_now();
+#endif
+    camera  &cam    = sc.cam;
+    cam.setWidth(dc.SCREEN_WIDTH);
+    cam.update(p.a);
+    float pdirx = cam.pdirx, pdiry = cam.pdiry;
+    float cdirx = cam.cdirx, cdiry = cam.cdiry;
+
+#ifdef NO_RENDER_TEX
+    // Columns are drawn with SDL renderer calls, those must stay here.
+    pool = nullptr;
+#endif
+#ifdef DEBUG
+    std::vector<WALL_HIT> hits(dc.SCREEN_WIDTH, WH_NONE);
+#endif
+    thingGrid &grid = sc.grid;
+    grid.beginFrame();
+    framePass cp {
+        p, map, tm, dc, cam, grid, z_buffer, buff.floor_h,
+#ifdef DEBUG
+        hits.data(),
+#endif
+    };
+
+#ifdef BENCH_RENDER
+    prof().zone(PZ_RAY_SETUP, t_setup, prof_now());
+#endif
+
+    // Walls, floor, ceiling.
+    auto columns = [&cp](int begin, int end){ drawColumns(cp, begin, end); };
+    if(pool)
+        pool->run(dc.SCREEN_WIDTH, columns);
+    else
+        columns(0, dc.SCREEN_WIDTH);
+
+#ifndef NO_RENDER_TEX
+    // Rows past the highest floor are all walls.
+    int floor_rows = *std::max_element(buff.floor_h, 
+                                       buff.floor_h + dc.SCREEN_WIDTH);
+    auto rows = [&cp](int begin, int end){
+        PROF_ZONE(PZ_FLOOR);
+        if(cp.tm.pot())
+            drawFloorRows<true >(cp, begin, end);
+        else
+            drawFloorRows<false>(cp, begin, end);
+    };
+    if(pool)
+        pool->run(floor_rows, rows);
+    else
+        rows(0, floor_rows);
+#endif
+
+    // Sprites, only of things in cells some ray went through.
+#ifdef BENCH_RENDER
+    prof_ns t_sprites = prof_now();
+#endif
+    grid.gather(order.visible);
+    order.update();
+    const std::vector<int> &things_ids = order.ids(); // slots of things
+    int th_size = things_ids.size();
+
+    spriteFrame sf;
+    sf.init(z_buffer, dc.SCREEN_WIDTH);
+
+    // Buffers's sizes are kept in sync with no of slots by the app.
+    sf.gather(things, things_ids, sc.alpha, p.x, p.y);
+    for(int s : things_ids) {
+        float tmp_x = sf.rel_x[s], tmp_y = sf.rel_y[s];
+        things_dst[s] = dot(tmp_x, tmp_y, tmp_x, tmp_y); //norm would do too.
+    }
+    // Still in last frame's order, so it is nearly sorted already.
+    order.sort(things_dst);
+
+    // calculating things position relative to [cdir, pdir] space.
+    float inv_det = 1.0 / (cdirx * pdiry - pdirx * cdiry);
+    for(int i = 0; i < th_size; ++i) {
+        int s = things_ids[i];
+        float tmp_x = sf.rel_x[s], tmp_y = sf.rel_y[s];
+        sf.th_x[i] = inv_det * (tmp_x * pdiry - tmp_y * pdirx); 
+        sf.th_y[i] = inv_det * (tmp_y * cdirx - tmp_x * cdiry); 
+    }
+    for(int i = 0; i < th_size; ++i) {
+        int t = things.denseOfSlot( things_ids[i] );
+        drawSprite(dc, sf, things.sprite[t], things.t_no[t], 
+                   sf.th_x[i], sf.th_y[i]);
+    }
+#ifdef BENCH_RENDER
+    prof().zone(PZ_SPRITES, t_sprites, prof_now());
+#endif
+
+    // The minimap goes over everything, and the rays over it.
+    PROF_ZONE(PZ_MINIMAP);
+    mm.draw(map, p, dc);
+#ifdef DEBUG
+    if(mm.m_rays) {
+        std::vector<mmLine> rays;
+        rays.reserve(dc.SCREEN_WIDTH + 2);
+        for(int i = 0; i < dc.SCREEN_WIDTH; i++) {
+            float rdirx = cam.rdirx[i];
+            float rdiry = cam.rdiry[i];
+            uint32_t col = hits[i] == WH_VERTICAL ? 0xFF00FFFF : 0xFFFFFFFF;
+            // Normalization factor to rdirx and rdiry is included in perpDist!
+            rays.push_back({ p.x, p.y, p.x+rdirx*z_buffer[i], 
+                             p.y+rdiry*z_buffer[i], col });
+        }
+        rays.push_back({ p.x, p.y, p.x+pdirx, p.y+pdiry, 0xFF00FF00 });
+        rays.push_back({ p.x, p.y, p.x+cdirx, p.y+cdiry, 0xFFFF0000 });
+        mm.drawLines(rays, map, dc);
+    }
+#endif
 }
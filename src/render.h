@@ -5,17 +5,23 @@
 #include "scene.h"
 #include "drawContext.h"
 #include "tileMap.h"
+#include "renderPool.h"
+#include "depthOrder.h"
 
 
 struct drawBuffers {
     float              *z; 
-    std::vector<float> &things_dst;
-    std::vector<int>   &things_ids;
+    int                *floor_h; // per column, floor/ceiling rows below walls
+    std::vector<float> &things_dst; // per thing, squared distance to the player
+    depthOrder         &things_order;
 };
 
 
+/* With a pool, walls, floor and ceiling are drawn by its threads, 
+ * sprites are always drawn by the caller once they are done. */
 void
-draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff);
+draw(scene &sc, drawContext &dc, tileMap &tm, drawBuffers buff,
+     renderPool *pool = nullptr);
 
 
 #endif
@@ -0,0 +1,115 @@
+#ifndef RENDERPOOL_SENTRY
+#define RENDERPOOL_SENTRY
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+
+/* Persistent worker threads for splitting a frame pass into chunks.
+ * The calling thread always takes chunk 0, so a pool of size 1 has no
+ * workers at all and run() is a plain function call. */
+class renderPool {
+  public:
+    using job_t = std::function<void(int begin, int end)>;
+
+    renderPool(int threads) {
+        if(threads < 1)
+            threads = std::thread::hardware_concurrency();
+        if(threads < 1)
+            threads = 1;
+        m_size = threads;
+        for(int i = 1; i < m_size; ++i)
+            m_workers.emplace_back( [this, i](){ work(i); } );
+    }
+
+    ~renderPool() {
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_quit = true;
+        }
+        m_start_cv.notify_all();
+        for(auto &w : m_workers)
+            w.join();
+    }
+
+    renderPool(const renderPool &other)            = delete;
+    renderPool &operator=(const renderPool &other) = delete;
+
+    int size() const { return m_size; };
+
+    /* Splits [0, n) into size() contiguous chunks and runs job on each.
+     * Returns once every chunk is done, so it doubles as a barrier. */
+    void run(int n, job_t job) {
+        if(m_size == 1) {
+            job(0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_job     = job;
+            m_n       = n;
+            m_pending = m_size - 1;
+            ++m_generation;
+        }
+        m_start_cv.notify_all();
+
+        runChunk(0);
+
+        std::unique_lock<std::mutex> lk(m_mtx);
+        m_done_cv.wait(lk, [this](){ return m_pending == 0; });
+        m_job = nullptr;
+    }
+
+  private:
+    void runChunk(int chunk) {
+        int begin = (long long)m_n *  chunk    / m_size;
+        int end   = (long long)m_n * (chunk+1) / m_size;
+        if(begin < end)
+            m_job(begin, end);
+    }
+
+    void work(int chunk) {
+        unsigned seen = 0;
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lk(m_mtx);
+                m_start_cv.wait(lk, [&](){
+                    return m_quit || m_generation != seen;
+                });
+                if(m_quit)
+                    return;
+                seen = m_generation;
+            }
+
+            runChunk(chunk);
+
+            bool last = false;
+            {
+                std::lock_guard<std::mutex> lk(m_mtx);
+                last = --m_pending == 0;
+            }
+            if(last)
+                m_done_cv.notify_one();
+        }
+    }
+
+    int m_size = 1;
+    std::vector<std::thread> m_workers;
+
+    std::mutex              m_mtx;
+    std::condition_variable m_start_cv;
+    std::condition_variable m_done_cv;
+
+    job_t    m_job;
+    int      m_n          = 0;
+    int      m_pending    = 0;
+    unsigned m_generation = 0;
+    bool     m_quit       = false;
+};
+
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef REPLAY_SENTRY
+#define REPLAY_SENTRY
+
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+#include "errors.h"
+#include "things.h"
+
+
+/* Replay file, the input of every simulation tick of a session:
+ *
+ *   replayHeader | replayTick ...
+ *
+ * Fields are little endian. The header holds the map it was recorded on
+ * and where the player started, each tick the keys held during it and
+ * where the player was after it, 13 bytes a tick. Playback feeds the keys
+ * to the simulation and checks the player ends up where it did when
+ * recorded. */
+#define REPLAY_MAGIC   "WOOFRPL"
+#define REPLAY_VERSION 2
+
+struct replayHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t tick_hz;
+    uint32_t map_w, map_h;
+    uint32_t map_hash;  // replay_map_hash()
+    float    x, y, a;
+};
+
+struct replayTick {
+    uint8_t keys;  // REPLAY_KEYS
+    float   x, y, a;
+};
+
+enum REPLAY_KEYS : uint8_t {
+    KEY_FORWARD = 1,
+    KEY_BACK    = 2,
+    KEY_LEFT    = 4,
+    KEY_RIGHT   = 8,
+};
+
+// Ticks are written field by field, without the padding of replayTick.
+#define REPLAY_TICK_SIZE (1 + 3 * sizeof(float))
+
+
+/* FNV-1a of what the player collides with, all the simulation steps by,
+ * so a replay is only run on the map it was recorded on. */
+inline uint32_t
+replay_map_hash(const Map &map)
+{
+    uint32_t h = 2166136261u;
+    for(int y = 0; y < map.h; ++y)
+        for(int x = 0; x < map.w; ++x) {
+            h ^= (uint8_t)map.getCollision(x, y);
+            h *= 16777619u;
+        }
+    return h;
+}
+
+inline uint8_t
+pack_input(const playerInput &in)
+{
+    return (in.forward ? KEY_FORWARD : 0) | (in.back  ? KEY_BACK  : 0)
+         | (in.left    ? KEY_LEFT    : 0) | (in.right ? KEY_RIGHT : 0);
+}
+
+inline playerInput
+unpack_input(uint8_t keys)
+{
+    playerInput in;
+    in.forward = keys & KEY_FORWARD;
+    in.back    = keys & KEY_BACK;
+    in.left    = keys & KEY_LEFT;
+    in.right   = keys & KEY_RIGHT;
+    return in;
+}
+
+
+class replayRecorder {
+  public:
+    err_code open(const char *path, const Thing &player, uint32_t tick_hz,
+                  const Map &map) {
+        m_file.open(path, std::ios::binary | std::ios::trunc);
+        if( !m_file.good() )
+            return REPLAY_FILE_NOT_OPENED;
+        replayHeader hdr;
+        std::memcpy(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic));
+        hdr.version = REPLAY_VERSION;
+        hdr.tick_hz = tick_hz;
+        hdr.map_w   = map.w;
+        hdr.map_h   = map.h;
+        hdr.map_hash = replay_map_hash(map);
+        hdr.x = player.x; hdr.y = player.y; hdr.a = player.a;
+        m_file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        return m_file.good() ? NO_ERROR : REPLAY_FILE_NOT_OPENED;
+    };
+
+    bool isOpen() const { return m_file.is_open(); };
+    void close() { m_file.close(); };
+
+    /* A tick run with in, which left the player where it is now. */
+    void record(const playerInput &in, const Thing &player) {
+        char rec[REPLAY_TICK_SIZE];
+        rec[0] = pack_input(in);
+        std::memcpy(rec + 1,                   &player.x, sizeof(float));
+        std::memcpy(rec + 1 +   sizeof(float), &player.y, sizeof(float));
+        std::memcpy(rec + 1 + 2*sizeof(float), &player.a, sizeof(float));
+        m_file.write(rec, sizeof(rec));
+    };
+
+  private:
+    std::ofstream m_file;
+};
+
+
+class replayPlayer {
+  public:
+    /* Reads the whole replay, it is small. Replays of other maps, or 
+     * which start the player off where it cannot stand, are refused. */
+    err_code load(const char *path, uint32_t tick_hz, const Map &map) {
+        std::ifstream f(path, std::ios::binary);
+        if( !f.good() )
+            return REPLAY_FILE_NOT_OPENED;
+        f.read(reinterpret_cast<char*>(&m_hdr), sizeof(m_hdr));
+        if( !f.good() || std::memcmp(m_hdr.magic, REPLAY_MAGIC,
+                                     sizeof(m_hdr.magic)) != 0 )
+            return REPLAY_FILE_WRONG_FORMAT;
+        // Other tick rates step the world differently.
+        if(m_hdr.version != REPLAY_VERSION || m_hdr.tick_hz != tick_hz)
+            return REPLAY_FILE_WRONG_FORMAT;
+        if(m_hdr.map_w != (uint32_t)map.w || m_hdr.map_h != (uint32_t)map.h
+        || m_hdr.map_hash != replay_map_hash(map))
+            return REPLAY_FILE_WRONG_FORMAT;
+        // Rays are cast from the player with no bounds checks.
+        float x = m_hdr.x, y = m_hdr.y;
+        if( !std::isfinite(x) || !std::isfinite(y) || !std::isfinite(m_hdr.a)
+         || x < 0 || x >= map.w || y < 0 || y >= map.h || map.isWall(x, y) )
+            return REPLAY_FILE_WRONG_FORMAT;
+
+        char rec[REPLAY_TICK_SIZE];
+        while( f.read(rec, sizeof(rec)) ) {
+            replayTick t;
+            t.keys = rec[0];
+            std::memcpy(&t.x, rec + 1,                   sizeof(float));
+            std::memcpy(&t.y, rec + 1 +   sizeof(float), sizeof(float));
+            std::memcpy(&t.a, rec + 1 + 2*sizeof(float), sizeof(float));
+            m_ticks.push_back(t);
+        }
+        m_loaded = true;
+        return NO_ERROR;
+    };
+
+    bool isLoaded() const { return m_loaded; };
+    bool done()     const { return m_next >= m_ticks.size(); };
+    size_t ticks()  const { return m_ticks.size(); };
+
+    /* Puts the player where the recording started. */
+    void start(Thing &player) const {
+        player.x = m_hdr.x; player.y = m_hdr.y; player.a = m_hdr.a;
+    };
+
+    /* Keys of the next tick. */
+    playerInput next() { return unpack_input(m_ticks[m_next++].keys); };
+
+    /* After the tick next() gave the keys of, false if the player is not
+     * where it was when recorded. The first such tick is kept. */
+    bool check(const Thing &player) {
+        const replayTick &t = m_ticks[m_next-1];
+        if(player.x == t.x && player.y == t.y && player.a == t.a)
+            return true;
+        if(m_desync < 0)
+            m_desync = m_next-1;
+        return false;
+    };
+
+    /* First tick that went elsewhere than recorded, -1 if none did. */
+    long desync() const { return m_desync; };
+
+  private:
+    replayHeader            m_hdr {};
+    std::vector<replayTick> m_ticks;
+    size_t                  m_next   = 0;
+    long                    m_desync = -1;
+    bool                    m_loaded = false;
+};
+
+
+#endif
@@ -4,13 +4,17 @@
 
 #include "things.h"
 #include "miniMap.h"
+#include "camera.h"
 
 
 struct scene {
     Map     &m;
     Thing   &p;
     Things  &things;
+    thingGrid &grid;  // where things are, by map cell
     miniMap &mm;
+    camera  &cam;
+    float    alpha;   // things are drawn this far from their last tick on
 };
 
 
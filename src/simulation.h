@@ -0,0 +1,107 @@
+#ifndef SIMULATION_SENTRY
+#define SIMULATION_SENTRY
+
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cmath>
+
+#include "things.h"
+#include "replay.h"
+#include "pi.h"
+
+
+/* The world moves in fixed steps of 1/SIM_TICK_HZ of a second, however
+ * fast or slow frames are rendered. */
+#define SIM_TICK_HZ 60
+// Longest real time one frame may catch up on, a stall beyond it is lost.
+#define SIM_MAX_CATCH_UP 0.25
+
+
+/* Keys held right now, SDL_PumpEvents() (or polling) keeps them current. */
+inline playerInput
+read_keyboard()
+{
+    const Uint8 *keys = SDL_GetKeyboardState(NULL);
+    playerInput in;
+    in.forward = keys[SDL_SCANCODE_W];
+    in.back    = keys[SDL_SCANCODE_S];
+    in.left    = keys[SDL_SCANCODE_A];
+    in.right   = keys[SDL_SCANCODE_D];
+    return in;
+}
+
+
+/* Advances the player and things tick by tick, and tells the renderer
+ * where they are between the last two ticks. */
+class simulation {
+  public:
+    const double dt = 1.0 / SIM_TICK_HZ;
+
+    simulation(Map &map, Thing &player, Things &things)
+        : m_map(map), m_player(player), m_things(things) { __keep(); };
+
+    simulation(const simulation &other)            = delete;
+    simulation &operator=(const simulation &other) = delete;
+
+    /* One step of the world. */
+    void tick(const playerInput &in) {
+        __keep();
+        m_player.control(in, dt, m_map);
+        m_things.step(m_map, dt);
+        ++m_ticks;
+        if(m_recorder)
+            m_recorder->record(in, m_player);
+    };
+
+    /* Every tick from now on is recorded, NULL stops it. */
+    void setRecorder(replayRecorder *r) { m_recorder = r; };
+
+    /* Runs as many ticks as seconds of real time have built up, keys
+     * held the whole time. Returns how many it ran. */
+    int advance(double seconds, const playerInput &in) {
+        m_acc += std::min(seconds, SIM_MAX_CATCH_UP);
+        int n = 0;
+        for(; m_acc >= dt; m_acc -= dt, ++n)
+            tick(in);
+        return n;
+    };
+
+    /* How far real time is past the last tick, in ticks, 0 to 1. */
+    float alpha() const { return m_acc / dt; };
+
+    unsigned long long ticks() const { return m_ticks; };
+
+    /* Puts view where the player is alpha of the way from the tick
+     * before last to the last one. */
+    void interpolate(Thing &view, float alpha) const {
+        view.x = m_px + (m_player.x - m_px) * alpha;
+        view.y = m_py + (m_player.y - m_py) * alpha;
+        float da = m_player.a - m_pa;
+        // The shorter way round.
+        if(da >  PI) da -= 2*PI;
+        if(da < -PI) da += 2*PI;
+        view.a = m_pa + da * alpha;
+    };
+
+  private:
+    void __keep() {
+        m_px = m_player.x;
+        m_py = m_player.y;
+        m_pa = m_player.a;
+        m_things.keepPrevious();
+    };
+
+    Map    &m_map;
+    Thing  &m_player;
+    Things &m_things;
+
+    replayRecorder *m_recorder = nullptr;
+
+    double m_acc = 0;
+    unsigned long long m_ticks = 0;
+    float  m_px = 0, m_py = 0, m_pa = 0;
+};
+
+
+#endif
@@ -0,0 +1,211 @@
+#include <cstring>
+
+#include <spans.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPANS_X86
+#include <immintrin.h>
+#endif
+
+
+static void copy_scalar(uint32_t *dst, const uint32_t *src, int n)
+{
+    std::memcpy(dst, src, n * sizeof(uint32_t));
+}
+
+static void mask_scalar(uint32_t *dst, const uint32_t *src, int n)
+{
+    for(int i = 0; i < n; ++i)
+        if(src[i] & AMASK)
+            dst[i] = src[i];
+}
+
+static void blend_scalar(uint32_t *dst, const uint32_t *src, int n)
+{
+    for(int i = 0; i < n; ++i)
+        dst[i] = blend_pixel(dst[i], src[i]);
+}
+
+
+#ifdef SPANS_X86
+/* blend_pixel() works per channel as (na*orig + a*new) >> 8 for R, G and B,
+ * and as ((na*orig) >> 8) + a for alpha. The latter is the same formula if 
+ * the new alpha is taken as 256, and with 16 bits per channel neither sum 
+ * can overflow, so both are done at once by a single multiply-add. */
+
+__attribute__((target("sse2")))
+static inline __m128i blend_half_sse2(__m128i o, __m128i n)
+{
+    const __m128i rgb  = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i a256 = _mm_set_epi16(256, 0, 0, 0, 256, 0, 0, 0);
+    const __m128i c255 = _mm_set1_epi16(255);
+    __m128i a  = _mm_shufflehi_epi16(
+                    _mm_shufflelo_epi16(n, _MM_SHUFFLE(3,3,3,3)),
+                    _MM_SHUFFLE(3,3,3,3));
+    __m128i na = _mm_sub_epi16(c255, a);
+    n = _mm_or_si128(_mm_and_si128(n, rgb), a256);
+    __m128i r = _mm_add_epi16(_mm_mullo_epi16(o, na), _mm_mullo_epi16(n, a));
+    return _mm_srli_epi16(r, 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(uint32_t *dst, const uint32_t *src, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128i o = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = blend_half_sse2(_mm_unpacklo_epi8(o, zero), 
+                                     _mm_unpacklo_epi8(s, zero));
+        __m128i hi = blend_half_sse2(_mm_unpackhi_epi8(o, zero), 
+                                     _mm_unpackhi_epi8(s, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blend_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(uint32_t *dst, const uint32_t *src, int n)
+{
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), 
+                         _mm_loadu_si128((const __m128i*)(src + i)));
+    copy_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void mask_sse2(uint32_t *dst, const uint32_t *src, int n)
+{
+    const __m128i amask = _mm_set1_epi32(AMASK);
+    const __m128i zero  = _mm_setzero_si128();
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128i o = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i keep = _mm_cmpeq_epi32(_mm_and_si128(s, amask), zero);
+        __m128i r = _mm_or_si128(_mm_and_si128(keep, o), 
+                                 _mm_andnot_si128(keep, s));
+        _mm_storeu_si128((__m128i*)(dst + i), r);
+    }
+    mask_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_half_avx2(__m256i o, __m256i n)
+{
+    const __m256i rgb  = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1,
+                                          0, -1, -1, -1, 0, -1, -1, -1);
+    const __m256i a256 = _mm256_set_epi16(256, 0, 0, 0, 256, 0, 0, 0,
+                                          256, 0, 0, 0, 256, 0, 0, 0);
+    const __m256i c255 = _mm256_set1_epi16(255);
+    __m256i a  = _mm256_shufflehi_epi16(
+                    _mm256_shufflelo_epi16(n, _MM_SHUFFLE(3,3,3,3)),
+                    _MM_SHUFFLE(3,3,3,3));
+    __m256i na = _mm256_sub_epi16(c255, a);
+    n = _mm256_or_si256(_mm256_and_si256(n, rgb), a256);
+    __m256i r = _mm256_add_epi16(_mm256_mullo_epi16(o, na), 
+                                 _mm256_mullo_epi16(n, a));
+    return _mm256_srli_epi16(r, 8);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, const uint32_t *src, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    // Unpacking and packing both work within 128 bit lanes, so pixels
+    // come back in the order they were loaded.
+    for(; i + 8 <= n; i += 8) {
+        __m256i o = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = blend_half_avx2(_mm256_unpacklo_epi8(o, zero), 
+                                     _mm256_unpacklo_epi8(s, zero));
+        __m256i hi = blend_half_avx2(_mm256_unpackhi_epi8(o, zero), 
+                                     _mm256_unpackhi_epi8(s, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    blend_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(uint32_t *dst, const uint32_t *src, int n)
+{
+    const __m256i amask = _mm256_set1_epi32(AMASK);
+    const __m256i zero  = _mm256_setzero_si256();
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i o = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i keep = _mm256_cmpeq_epi32(_mm256_and_si256(s, amask), zero);
+        _mm256_storeu_si256((__m256i*)(dst + i), 
+                            _mm256_blendv_epi8(s, o, keep));
+    }
+    mask_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(uint32_t *dst, const uint32_t *src, int n)
+{
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i*)(dst + i), 
+                            _mm256_loadu_si256((const __m256i*)(src + i)));
+    copy_sse2(dst + i, src + i, n - i);
+}
+#endif
+
+
+static const spanKernels scalar_kernels = {
+    SPAN_SCALAR, "scalar", copy_scalar, mask_scalar, blend_scalar,
+};
+#ifdef SPANS_X86
+static const spanKernels sse2_kernels = {
+    SPAN_SSE2,   "sse2",   copy_sse2,   mask_sse2,   blend_sse2,
+};
+static const spanKernels avx2_kernels = {
+    SPAN_AVX2,   "avx2",   copy_avx2,   mask_avx2,   blend_avx2,
+};
+#endif
+
+static const spanKernels *
+find_kernels(SPAN_ISA isa)
+{
+#ifdef SPANS_X86
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_sse2 = __builtin_cpu_supports("sse2");
+    switch(isa) {
+        case(SPAN_AUTO): {
+            if(has_avx2) return &avx2_kernels;
+            if(has_sse2) return &sse2_kernels;
+            return &scalar_kernels;
+        }
+        case(SPAN_AVX2):   return has_avx2 ? &avx2_kernels : nullptr;
+        case(SPAN_SSE2):   return has_sse2 ? &sse2_kernels : nullptr;
+        case(SPAN_SCALAR): return &scalar_kernels;
+    }
+    return nullptr;
+#else
+    return isa == SPAN_AUTO || isa == SPAN_SCALAR ? &scalar_kernels : nullptr;
+#endif
+}
+
+// Only ever changed by select_span_kernels(), before drawing starts.
+static const spanKernels *current_kernels = nullptr;
+
+const spanKernels &span_kernels(void)
+{
+    static const spanKernels *auto_kernels = find_kernels(SPAN_AUTO);
+    return current_kernels ? *current_kernels : *auto_kernels;
+}
+
+bool select_span_kernels(SPAN_ISA isa)
+{
+    const spanKernels *k = find_kernels(isa);
+    if(!k)
+        return false;
+    current_kernels = k;
+    return true;
+}
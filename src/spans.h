@@ -0,0 +1,69 @@
+#ifndef SPANS_SENTRY
+#define SPANS_SENTRY
+
+
+#include <cstdint>
+
+#include "pixel.h"
+
+
+/* Reference blend of new_col over orig_col, both REQUIRED_PIXEL_FORMAT. 
+ * Every span kernel below must produce exactly the same pixels. */
+inline uint32_t 
+blend_pixel(uint32_t orig_col, uint32_t new_col)
+{
+    static const uint32_t RBMASK = RMASK | BMASK;
+    static const uint32_t AGMASK = AMASK | GMASK;
+    uint32_t a  = GET_A(new_col);
+    uint32_t na = 255 - a;
+    uint32_t rb = ((na * (orig_col & RBMASK)) + (a * (new_col & RBMASK))) >> 8;
+    uint32_t ag = (na * ((orig_col & AGMASK) >> 8)) + (a * (ONEALPHA | ((new_col & GMASK) >> 8)));
+    return ((rb & RBMASK) | (ag & AGMASK));
+}
+
+
+/* How pixels of a source have to be written. Ordered, so the class of 
+ * mixed pixels is the max of their classes. */
+enum ALPHA_CLASS : uint8_t {
+    ALPHA_OPAQUE,      // every alpha is 255, a plain store
+    ALPHA_KEYED,       // every alpha is 0 or 255, a masked store
+    ALPHA_TRANSLUCENT, // anything else, a full blend
+};
+
+inline ALPHA_CLASS
+alpha_class(uint32_t col)
+{
+    uint32_t a = GET_A(col);
+    return a == 255 ? ALPHA_OPAQUE : a == 0 ? ALPHA_KEYED : ALPHA_TRANSLUCENT;
+}
+
+
+enum SPAN_ISA {
+    SPAN_AUTO,   // the best one the CPU supports
+    SPAN_SCALAR,
+    SPAN_SSE2,
+    SPAN_AVX2,
+};
+
+using span_fn = void(*)(uint32_t *dst, const uint32_t *src, int n);
+
+struct spanKernels {
+    SPAN_ISA    isa;
+    const char *name;
+    span_fn     copy;   // dst = src
+    span_fn     mask;   // dst = src where src alpha is not 0
+    span_fn     blend;  // dst = blend_pixel(dst, src)
+};
+
+/* Kernels in use. Until select_span_kernels() is called those are the
+ * SPAN_AUTO ones. */
+const spanKernels &
+span_kernels(void);
+
+/* Returns false and keeps the current kernels if the CPU (or the compiler)
+ * cannot do isa. Not thread safe, call it before drawing. */
+bool
+select_span_kernels(SPAN_ISA isa);
+
+
+#endif
@@ -10,11 +10,16 @@
 #include <fstream>
 #include <stdlib.h>
 #include <cctype>
+#include <cstring>
+#include <string>
+#include <mutex>
 
 #include "drawContext.h"
 #include "tileMap.h"
 #include "errors.h"
 #include "pi.h"
+#include "mapFile.h"
+#include "debugLog.h"
 
 
 
@@ -26,18 +31,8 @@ struct boundBox {
 };
 
 
-enum MAP_ERRORS : signed char {
-    OUT_OF_BOUNDS = -1,
-};
-
-enum COLLISIONS : char {
-    FLOOR         = 0,
-    WALL          = 1,
-};
-
-
 class Map {
-    using REPR_PTR = std::unique_ptr<char[], void(*)(void*)>;
+    using REPR_PTR = std::unique_ptr<mapCell[], void(*)(void*)>;
 
   public:
     int w = 0; 
@@ -46,26 +41,19 @@ class Map {
     Map() {};
     Map(const char *path) { load(path); };
 
+    /* Loads MAP_FILE_NAME from the path directory if there is one, and the
+     * text layers otherwise. */
     int load(const char *path) {
-        int ret = 0;
         std::string str(path); 
-        if(ret = __load( m_walls, str + std::string("/walls.txt") ) )
-            return ret;
-        if(ret = __load( m_floor, str + std::string("/floor.txt") ) )
-            return ret;
-        if(ret = __load( m_ceil , str + std::string("/ceil.txt" ) ) )
+        int ret = __loadBinary( str + "/" MAP_FILE_NAME );
+        if(ret != MAP_FILE_NOT_OPENED)
             return ret;
-        if(ret = __load( m_coll , str + std::string("/coll.txt" ) ) )
-            return ret;
-        return ret;
+        return __loadText(str);
     };
     
     bool isLoaded() const { 
         return 
-            m_walls != nullptr &&
-            m_floor != nullptr && 
-            m_ceil  != nullptr && 
-            m_coll  != nullptr; 
+            m_cells != nullptr; 
     };
 
     template<typename T>
@@ -73,7 +61,7 @@ class Map {
         translateXY(x, y);
         if( !_isWithin(x, y) )
             return OUT_OF_BOUNDS;
-        return _getTile(m_coll, x, y);
+        return _getTile(&mapCell::coll, x, y);
     };
 
     template<typename T>
@@ -81,7 +69,7 @@ class Map {
         translateXY(x, y);
         if( !_isWithin(x, y) )
             return OUT_OF_BOUNDS;
-        return _getTile(m_walls, x, y);
+        return _getTile(&mapCell::wall, x, y);
     };
 
     template<typename T>
@@ -89,7 +77,7 @@ class Map {
         translateXY(x, y);
         if( !_isWithin(x, y) )
             return OUT_OF_BOUNDS;
-        return _getTile(m_floor, x, y);
+        return _getTile(&mapCell::floor, x, y);
     };
 
     template<typename T>
@@ -97,7 +85,7 @@ class Map {
         translateXY(x, y);
         if( !_isWithin(x, y) )
             return OUT_OF_BOUNDS;
-        return _getTile(m_ceil, x, y);
+        return _getTile(&mapCell::ceil, x, y);
     };
 
     template<typename T>
@@ -118,6 +106,24 @@ class Map {
         return _isWithin(x, y);
     };
 
+    /* Unchecked access for the renderer, once x and y are known to be 
+     * within the map or on its border. xy with origin in BOT LEFT. */
+    const mapCell &cell(int x, int y) const {
+        return m_cells[cellIndex(x, y)];
+    };
+
+    /* The map is surrounded by a one cell wide solid border, so a ray that
+     * starts within it ends on a WALL without any bounds checks. Rows of
+     * cells, border included, are stride() apart, and a row up in map space
+     * is stride() down in memory. */
+    const mapCell *cells()  const { return m_cells; };
+    int            stride() const { return m_stride; };
+
+    int cellIndex(int x, int y) const { //xy with origin in BOT LEFT
+        translateXY(x, y);
+        return m_stride*(y+1)+x+1;
+    };
+
     bool canMoveTo(float x, float y, boundBox &bbx) const {
         boundBox nbbx = bbx; 
         translateXY(x, y);
@@ -133,8 +139,8 @@ class Map {
     void translateXY(int   &x, int   &y) const { y = h-y-1; };
     void translateXY(float &x, float &y) const { y = (float)h-y; };
 
-    char _getTile(const REPR_PTR &repr, int x, int y) const {
-        return repr[w*y+x];
+    char _getTile(char mapCell::*layer, int x, int y) const {
+        return m_cells[m_stride*(y+1)+x+1].*layer;
     };
 
     bool _isWithin(boundBox &bbx) const {
@@ -157,23 +163,22 @@ class Map {
 
     bool _canMoveTo(float x, float y, boundBox &bbx) const {
 #ifdef DEBUG
-        std::cout << "testing coordinates " << x << " " << y << std::endl;
+        DEBUG_LOG("testing coordinates %f %f", x, y);
 #endif
         //adjustXY(&x, &y);
         if( !_isWithin(bbx) )
             return false;
 #ifdef DEBUG
-        std::cout << bbx.tlx << " " << bbx.tly << " "
-                  << bbx.brx << " " << bbx.bry << std::endl;
+        DEBUG_LOG("%f %f %f %f", bbx.tlx, bbx.tly, bbx.brx, bbx.bry);
 #endif
-        if( _getTile(m_walls, bbx.brx, bbx.bry) != FLOOR
-         || _getTile(m_walls, bbx.brx, bbx.tly) != FLOOR
-         || _getTile(m_walls, bbx.tlx, bbx.bry) != FLOOR
-         || _getTile(m_walls, bbx.tlx, bbx.tly) != FLOOR
+        if( _getTile(&mapCell::wall, bbx.brx, bbx.bry) != FLOOR
+         || _getTile(&mapCell::wall, bbx.brx, bbx.tly) != FLOOR
+         || _getTile(&mapCell::wall, bbx.tlx, bbx.bry) != FLOOR
+         || _getTile(&mapCell::wall, bbx.tlx, bbx.tly) != FLOOR
         )
             return false;
 #ifdef DEBUG
-        std::cout << "can move to " << x << " " << y << std::endl;
+        DEBUG_LOG("can move to %f %f", x, y);
 #endif
         return true;
     };
@@ -188,39 +193,240 @@ class Map {
             *yp = testy;
     };
 
-    int __load(REPR_PTR &repr, std::string path) {
-        std::ifstream f_map(path);
-        if( !f_map.good() ) {
+    int __loadText(const std::string &dir) {
+        static const char *names[LAYERS_NO] = {
+            "/walls.txt", "/floor.txt", "/ceil.txt", "/coll.txt",
+        };
+        std::vector<char> layers[LAYERS_NO];
+        int map_w = 0, map_h = 0;
+        for(uint32_t i = 0; i < LAYERS_NO; ++i) {
+            int lw = 0, lh = 0;
+            int ret = read_text_layer(dir + names[i], lw, lh, layers[i]);
+            if(ret)
+                return ret;
+            if(i != 0 && (lw != map_w || lh != map_h)) {
 #ifdef DEBUG
-            std::cout << "Cannot open map in " << path << std::endl;
+                std::cout << "Wrong dimensions of map " << dir + names[i] 
+                          << std::endl;
 #endif
-            return MAP_FILE_NOT_OPENED;
-        }
-        int map_w, map_h;
-        f_map >> map_w >> map_h;
-        int wh = map_w * map_h;
-        char *r = reinterpret_cast<char *>( calloc(wh+1, 1) );
-        int i = 0;
-        while( f_map && i < wh ) {
-            char c; f_map >> c;
-            r[i++] = c - 48; //ascii
+                return MAP_WRONG_DIMENSIONS;
+            }
+            map_w = lw; map_h = lh;
         }
 
-        if(i != wh || ( (w!=0 && map_w!=w) || (h!=0 && map_h!=h) )) {
+        mapCell *r = __allocBordered(map_w, map_h);
+        if(!r)
+            return MAP_NOT_LOADED;
+        const char *const planes[LAYERS_NO] = {
+            layers[LAYER_WALLS].data(), layers[LAYER_FLOOR].data(),
+            layers[LAYER_CEIL ].data(), layers[LAYER_COLL ].data(),
+        };
+        interleave_layers(map_w, map_h, planes, r);
+
+        m_file.close();
+        __setCells(r, map_w, map_h);
+        return 0;
+    };
+
+    int __loadBinary(const std::string &path) {
+        mapFile f;
+        if( !f.open(path) )
+            return MAP_FILE_NOT_OPENED;
+        const mapFileHeader *hdr = nullptr;
+        const mapCell *cells = nullptr;
+        bool bordered = false;
+        const char *layers[LAYERS_NO];
+        int ret = parse_map_file(f.data(), f.size(), hdr, 
+                                 cells, bordered, layers);
+        if(ret) {
 #ifdef DEBUG
-            std::cout << "Wrong dimensions of map " << path << std::endl;
+            std::cout << "Cannot use map file " << path 
+                      << ", error " << ret << std::endl;
 #endif
+            return ret;
+        }
+        // Rays index cells with ints and no bounds checks.
+        if( !map_dimensions_fit(hdr->w, hdr->h) )
             return MAP_WRONG_DIMENSIONS;
+        int map_w = hdr->w, map_h = hdr->h;
+        if(cells && bordered) {
+            // Rays walk the map until they hit a wall, the flag alone is
+            // not trusted with keeping them inside it.
+            if( !border_is_solid(map_w, map_h, cells) ) {
+#ifdef DEBUG
+                std::cout << "Border of map file " << path 
+                          << " is not solid" << std::endl;
+#endif
+                return MAP_NOT_LOADED;
+            }
+            // Cells are used right where they are mapped.
+            m_repr.reset();
+            m_cells  = cells;
+            m_stride = map_w + 2;
+            w = map_w; h = map_h;
+            m_file.swap(f);
+            return 0;
         }
-        repr.reset(r); 
-        w = map_w; h = map_h;
+        // Older files have to be bordered (and interleaved) first.
+        mapCell *r = __allocBordered(map_w, map_h);
+        if(!r)
+            return MAP_NOT_LOADED;
+        if(cells)
+            border_copy(map_w, map_h, cells, r);
+        else
+            interleave_layers(map_w, map_h, layers, r);
+        m_file.close();
+        __setCells(r, map_w, map_h);
         return 0;
     };
 
-    REPR_PTR m_walls { nullptr, free } ;
-    REPR_PTR m_floor { nullptr, free } ;
-    REPR_PTR m_ceil  { nullptr, free } ;
-    REPR_PTR m_coll  { nullptr, free } ;
+    mapCell *__allocBordered(int map_w, int map_h) {
+        size_t n = (size_t)(map_w+2) * (map_h+2);
+        return reinterpret_cast<mapCell *>( calloc(n, sizeof(mapCell)) );
+    };
+
+    void __setCells(mapCell *owned, int map_w, int map_h) {
+        m_repr.reset(owned);
+        m_cells  = owned;
+        m_stride = map_w + 2;
+        w = map_w; h = map_h;
+    };
+
+    // Cells live either in m_repr or in m_file.
+    REPR_PTR m_repr { nullptr, free } ;
+    mapFile  m_file;
+
+    const mapCell *m_cells  = nullptr;
+    int            m_stride = 0;
+};
+
+
+/* Things bucketed by the map cell they stand in, so the renderer looks 
+ * only at things in cells its rays went through instead of at every one.
+ * Ids are whatever the owner tells things apart by, Things indices here.
+ * Cells are indexed like Map::cellIndex(), the very index the rays walk
+ * the map with. Every bucket is a doubly linked list threaded through 
+ * per id arrays, so moving a thing to another cell is O(1). */
+class thingGrid {
+  public:
+    thingGrid(const Map &map) : m_map(map) {
+        size_t cells = (size_t)(map.w+2) * (map.h+2);
+        m_head.assign(cells, -1);
+        m_seen.assign(cells,  0);
+    };
+
+    thingGrid(const thingGrid &other)            = delete;
+    thingGrid &operator=(const thingGrid &other) = delete;
+
+    void insert(int id, float x, float y) {
+        __grow(id);
+        remove(id);
+        __link(id, __cellOf(x, y));
+    };
+
+    void remove(int id) {
+        if(id < (int)m_cell.size())
+            __unlink(id);
+    };
+
+    /* Only relinks the thing when it crossed into another cell. */
+    void move(int id, float x, float y) {
+        int cell = __cellOf(x, y);
+        if(m_cell[id] == cell)
+            return;
+        __unlink(id);
+        __link(id, cell);
+    };
+
+    /* Puts id where x, y is, whether it was in the grid or not, and 
+     * relinks it only when it is not in that cell already. */
+    void place(int id, float x, float y) {
+        __grow(id);
+        move(id, x, y);
+    };
+
+    /* Starts noting the cells seen by a new frame. */
+    void beginFrame() {
+        ++m_frame;
+        m_visible.clear();
+    };
+
+    /* Notes cells some rays went through, repeats are fine. Rays of a 
+     * frame may be cast by several threads at once. */
+    void see(const std::vector<int> &cells) {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        for(int c : cells) {
+            if(m_seen[c] == m_frame)
+                continue;
+            m_seen[c] = m_frame;
+            m_visible.push_back(c);
+        }
+    };
+
+    /* Ids of things standing in cells seen this frame. */
+    void gather(std::vector<int> &ids) const {
+        ids.clear();
+        for(int c : m_visible)
+            for(int id = m_head[c]; id >= 0; id = m_next[id])
+                ids.push_back(id);
+    };
+
+  private:
+    void __grow(int id) {
+        if(id < (int)m_cell.size())
+            return;
+        m_cell.resize(id+1, -1);
+        m_next.resize(id+1, -1);
+        m_prev.resize(id+1, -1);
+    };
+
+    int __cellOf(float x, float y) const {
+        if( !m_map.isWithin(x, y) )
+            return -1; // nowhere to be seen
+        return m_map.cellIndex((int)x, (int)y);
+    };
+
+    void __link(int id, int cell) {
+        m_cell[id] = cell;
+        m_prev[id] = -1;
+        m_next[id] = -1;
+        if(cell < 0)
+            return;
+        m_next[id] = m_head[cell];
+        if(m_head[cell] >= 0)
+            m_prev[ m_head[cell] ] = id;
+        m_head[cell] = id;
+    };
+
+    void __unlink(int id) {
+        int cell = m_cell[id];
+        if(cell < 0)
+            return;
+        if(m_prev[id] >= 0) m_next[ m_prev[id] ] = m_next[id];
+        else                m_head[cell]         = m_next[id];
+        if(m_next[id] >= 0) m_prev[ m_next[id] ] = m_prev[id];
+        m_cell[id] = -1;
+    };
+
+    const Map &m_map;
+    std::vector<int> m_head;  // first id in a cell
+    std::vector<int> m_cell;  // cell of an id, -1 if none
+    std::vector<int> m_next;
+    std::vector<int> m_prev;
+
+    std::mutex            m_mtx;
+    unsigned              m_frame = 0;
+    std::vector<unsigned> m_seen;    // frame a cell was last seen in
+    std::vector<int>      m_visible; // cells seen this frame
+};
+
+
+/* Keys held during a tick. */
+struct playerInput {
+    bool forward = false;
+    bool back    = false;
+    bool left    = false; // turn
+    bool right   = false;
 };
 
 
@@ -229,7 +435,8 @@ class Thing {
     //x and y of thing's center 
     float x;
     float y;
-    float v  = 0.1;
+    float v  = 3;    // per second
+    float av = 3;    // turning, radians per second
     float w  = 0.2;
     float h  = 0.2;
     float a  = PI/2;
@@ -248,35 +455,19 @@ class Thing {
 
     ~Thing() {};
 
-    void handle(SDL_Keycode k_code, Map &map) {
-        float newx = x;
-        float newy = y;
+    /* One fixed step of dt seconds with the keys of in held. */
+    void control(const playerInput &in, float dt, Map &map) {
         float twopi= 2*PI;
-        bool  moving=false;
-
-        switch(k_code) {
-            case(SDLK_w): {
-                newy = y + sin(a)*v;
-                newx = x + cos(a)*v;
-                moving = true;
-            } break;
-            case(SDLK_s): {
-                newy = y - sin(a)*v;
-                newx = x - cos(a)*v;
-                moving = true;
-            } break;
-            case(SDLK_a): {
-                a += 0.1; a = a-twopi>0.001 ? 0 : a; 
-            } break;
-            case(SDLK_d): {
-                a -= 0.1; a = a < 0.0 ? twopi : a; 
-            } break;
-            default:
-                return;
+        float turn = (in.left ? 1 : 0) - (in.right ? 1 : 0);
+        float walk = (in.forward ? 1 : 0) - (in.back ? 1 : 0);
+
+        if(turn != 0) {
+            a += turn * av * dt;
+            a  = std::fmod(a, twopi);
+            if(a < 0) a += twopi;
         }
-        
-        if(moving)
-            moveTo(newx, newy, map);
+        if(walk != 0)
+            moveTo(x + cos(a)*v*walk*dt, y + sin(a)*v*walk*dt, map);
     }
 
     bool moveTo(float newx, float newy, Map &map) {
@@ -295,7 +486,184 @@ class Thing {
     }
 };
 
-using Things = std::vector<Thing>;
+/* Refers to one of Things for as long as it exists. A slot is reused once
+ * its thing is removed, the generation tells the old handles apart. */
+struct thingHandle {
+    uint32_t slot;
+    uint32_t gen;
+};
+
+/* Things of the world, pickups and such, as parallel arrays, so passes 
+ * over all of them touch only the fields they need. Arrays are dense, 
+ * index i is the i-th thing alive, and removal moves the last thing into
+ * the hole. Handles and slots stay put meanwhile, so whatever keeps 
+ * things from frame to frame (thingGrid, depthOrder) keeps slots. */
+class Things {
+  public:
+    std::vector<float>     x;       // center
+    std::vector<float>     y;
+    std::vector<float>     px;      // center as of keepPrevious()
+    std::vector<float>     py;
+    std::vector<float>     v;       // speed along a, per second
+    std::vector<float>     a;
+    std::vector<float>     w;       // bounding box
+    std::vector<float>     h;
+    std::vector<tileMap *> sprite;
+    std::vector<int>       t_no;
+
+    Things() {};
+
+    Things(const Things &other)            = delete;
+    Things &operator=(const Things &other) = delete;
+
+    size_t size()  const { return x.size(); };
+    // Slots ever used, every slot is below it.
+    size_t slots() const { return m_gen.size(); };
+
+    void reserve(size_t n) {
+        for(auto *f : { &x, &y, &px, &py, &v, &a, &w, &h })
+            f->reserve(n);
+        sprite.reserve(n);
+        t_no.reserve(n);
+        m_slot.reserve(n);
+    };
+
+    thingHandle add(float tx, float ty, tileMap *s, int t) {
+        uint32_t slot;
+        if( !m_free.empty() ) {
+            slot = m_free.back();
+            m_free.pop_back();
+        } else {
+            slot = m_gen.size();
+            m_gen.push_back(0);
+            m_dense.push_back(-1);
+        }
+        m_dense[slot] = size();
+        m_slot.push_back(slot);
+        x.push_back(tx); y.push_back(ty);
+        px.push_back(tx); py.push_back(ty);
+        v.push_back(0);  a.push_back(PI/2);
+        w.push_back(0.2); h.push_back(0.2);
+        sprite.push_back(s);
+        t_no.push_back(t);
+        if(m_grid)
+            m_grid->insert(slot, tx, ty);
+        return { slot, m_gen[slot] };
+    };
+
+    bool alive(thingHandle t) const {
+        return t.slot < m_gen.size() && m_gen[t.slot] == t.gen;
+    };
+
+    bool remove(thingHandle t) {
+        if( !alive(t) )
+            return false;
+        int i    = m_dense[t.slot];
+        int last = size() - 1;
+        __moveDense(last, i);
+        for(auto *f : { &x, &y, &px, &py, &v, &a, &w, &h })
+            f->pop_back();
+        sprite.pop_back();
+        t_no.pop_back();
+        m_slot.pop_back();
+        if(m_grid)
+            m_grid->remove(t.slot);
+        m_dense[t.slot] = -1;
+        ++m_gen[t.slot];
+        m_free.push_back(t.slot);
+        return true;
+    };
+
+    // Index into the arrays, -1 for things that are gone.
+    int dense(thingHandle t) const { return alive(t) ? m_dense[t.slot] : -1; };
+    int denseOfSlot(int slot) const { return m_dense[slot]; };
+    int slot(int i)           const { return m_slot[i]; };
+
+    /* Indexes every thing in grid by its slot, and keeps it up to date
+     * as things are added, moved and removed. */
+    void attach(thingGrid &g) {
+        m_grid = &g;
+        for(size_t i = 0; i < size(); ++i)
+            g.insert(m_slot[i], x[i], y[i]);
+    };
+
+    /* Becomes a copy of other, handles and all, reusing the memory it 
+     * already has. Its own grid, if any, is brought up to date by moving
+     * only the things that changed cells since the last copy, so a copy
+     * costs O(things) however large the map is. */
+    void copyFrom(const Things &other) {
+        x  = other.x;  y  = other.y;
+        px = other.px; py = other.py;
+        v  = other.v;  a  = other.a;
+        w  = other.w;  h  = other.h;
+        sprite  = other.sprite;
+        t_no    = other.t_no;
+        m_gen   = other.m_gen;
+        m_dense = other.m_dense;
+        m_slot  = other.m_slot;
+        m_free  = other.m_free;
+        if(m_grid)
+            for(size_t s = 0; s < slots(); ++s) {
+                int i = m_dense[s];
+                if(i < 0) m_grid->remove(s);
+                else      m_grid->place(s, x[i], y[i]);
+            }
+    };
+
+    bool moveTo(int i, float newx, float newy, Map &map) {
+        float halfw= w[i]/2;
+        float halfh= h[i]/2;
+        struct boundBox bbx = {
+            newx-halfw,
+            newy-halfh,
+            newx+halfw, 
+            newy+halfh,
+        };
+        if( !map.canMoveTo(newx, newy, bbx) )
+            return false;
+        x[i] = newx; y[i] = newy;
+        if(m_grid)
+            m_grid->move(m_slot[i], newx, newy);
+        return true;
+    };
+
+    /* Moves every thing with a speed along its angle for dt seconds, 
+     * one pass over all. */
+    void step(Map &map, float dt) {
+        for(size_t i = 0; i < size(); ++i) {
+            if(v[i] == 0)
+                continue;
+            float d = v[i] * dt;
+            moveTo(i, x[i] + cos(a[i])*d, y[i] + sin(a[i])*d, map);
+        }
+    };
+
+    /* Remembers where things are, before a step moves them. */
+    void keepPrevious() {
+        px = x;
+        py = y;
+    };
+
+  private:
+    void __moveDense(int from, int to) {
+        if(from == to)
+            return;
+        x[to] = x[from]; y[to] = y[from];
+        px[to] = px[from]; py[to] = py[from];
+        v[to] = v[from]; a[to] = a[from];
+        w[to] = w[from]; h[to] = h[from];
+        sprite[to] = sprite[from];
+        t_no  [to] = t_no  [from];
+        m_slot[to] = m_slot[from];
+        m_dense[ m_slot[to] ] = to;
+    };
+
+    std::vector<uint32_t> m_gen;   // per slot
+    std::vector<int>      m_dense; // per slot, index into the arrays
+    std::vector<uint32_t> m_slot;  // per index
+    std::vector<uint32_t> m_free;  // slots to reuse
+    thingGrid            *m_grid = nullptr;
+};
 
 
 #endif
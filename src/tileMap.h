@@ -9,9 +9,14 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 
 #include "pixel.h"
+#include "spans.h"
 #include "errors.h"
+#include "debugLog.h"
 
 
 #define DEFAULT_TW 64
@@ -29,9 +34,10 @@ struct colorRBGA {
 
 class tileMap {
   public:
-    const int m_tw = DEFAULT_TW;
-    const int m_th = DEFAULT_TH;
-    const int m_td = DEFAULT_TW * DEFAULT_TH;
+    // Tile size of the atlas, set by load().
+    int m_tw = DEFAULT_TW;
+    int m_th = DEFAULT_TH;
+    int m_td = DEFAULT_TW * DEFAULT_TH;
 
     tileMap() {}
     tileMap(uint32_t transparent_color) : 
@@ -40,7 +46,9 @@ class tileMap {
         m_transparent_color( RGBA_TO_REQUIRED(transparent_color) ) {};
     ~tileMap() { m_pixels = nullptr; m_no_textures = 0; }
 
-    err_code load(const char *path) {
+    /* Tiles of the atlas at path are tw x th texels, any size will do. 
+     * 0 takes the whole width or height of the image. */
+    err_code load(const char *path, int tw = DEFAULT_TW, int th = DEFAULT_TH) {
         TILEMAP_PTR tm { IMG_Load(path), SDL_FreeSurface };
         if(NULL == tm) {
 #ifdef DEBUG
@@ -97,6 +105,19 @@ class tileMap {
             std::swap(tm, s);
         }
 
+        if(tw == 0) tw = tm->w;
+        if(th == 0) th = tm->h;
+        if(tw < 0 || th < 0 || tw > tm->w || th > tm->h) {
+#ifdef DEBUG
+            std::cout << "Wrong tile size " << tw << "x" << th 
+                      << " of tile map " << path << ". " << std::endl;
+#endif
+            return TILEMAP_WRONG_TILE_SIZE;
+        }
+        m_tw = tw;
+        m_th = th;
+        m_td = tw * th;
+
         uint32_t *p = __extractPixels( tm.get() );
         if(!p) {
 #ifdef DEBUG
@@ -121,25 +142,127 @@ class tileMap {
 
         m_no_textures = (tm->w/m_tw) * (tm->h/m_th);
         m_pixels.reset(p);
+        __classifyTiles();
+        if( !__buildMips() ) {
+#ifdef DEBUG
+            std::cout << "Cannot build mipmaps of tilemap " << path << "."
+                      << std::endl;
+#endif
+            return TILEMAP_NO_PIXELS_GOT;
+        }
+        if( transposed() ) {
+            m_columns.reset();
+            setTransposed(true);
+        }
 
         return NO_ERROR; 
     }
     bool isLoaded() { return m_pixels != nullptr; }
 
+    /* Tells how texels of t_no have to be written, see ALPHA_CLASS. */
+    ALPHA_CLASS alphaClass(int t_no) const {
+        if(t_no < 0 || (size_t)t_no >= m_no_textures)
+            return ALPHA_KEYED; // getColor() gives transparent black there
+        return m_alpha[t_no];
+    }
+
     uint8_t get_r(uint32_t c) { return (((c&R_mask) >> Rshift) << R_loss); }
     uint8_t get_g(uint32_t c) { return (((c&G_mask) >> Gshift) << G_loss); }
     uint8_t get_b(uint32_t c) { return (((c&B_mask) >> Bshift) << B_loss); }
     uint8_t get_a(uint32_t c) { return (((c&A_mask) >> Ashift) << A_loss); }
 
-    uint32_t getColor(int t_no, int x, int y) {
-        if(t_no >= m_no_textures || x >= m_tw || y >= m_th) {
+    /* Power of two tiles wrap texel coordinates with a mask, the others
+     * have to compare. */
+    bool pot() const {
+        return (m_tw & (m_tw-1)) == 0 && (m_th & (m_th-1)) == 0;
+    }
+
+    /* Every tile has a chain of mip levels, each half the size of the one
+     * above, down to a single texel. Level 0 is the tile as loaded. */
+    int  mipLevels() const { return m_levels; }
+    bool mipmaps()   const { return m_mipmaps; }
+    void setMipmaps(bool on) { m_mipmaps = on; }
+
+    /* The level to sample when neighbouring screen pixels are that many
+     * texels of level 0 apart. Always 0 with mipmaps switched off. */
+    int mipLevel(float texels_per_pixel) const {
+        if(!m_mipmaps || !(texels_per_pixel >= 2.0f))
+            return 0;
+        int l = std::ilogb(texels_per_pixel); // floor of log2
+        return std::min(l, m_levels-1);
+    }
+
+    /* Walls are drawn a column at a time, and column texels of a row 
+     * major tile are a whole row apart. The transposed copy keeps every 
+     * column of every level in one piece instead, so a wall span reads 
+     * its texels one after another. Floors keep sampling m_pixels. */
+    bool transposed() const { return m_columns != nullptr; }
+    void setTransposed(bool on) {
+        if(!on) {
+            m_columns.reset();
+            return;
+        }
+        if(m_columns || !m_pixels)
+            return;
+        size_t total = m_level_off.back() + m_no_textures
+                     * (m_tw >> (m_levels-1)) * (m_th >> (m_levels-1));
+        uint32_t *c = reinterpret_cast<uint32_t*>(
+            malloc(total * sizeof(uint32_t)) );
+        if(!c)
+            return; // walls just keep reading rows
+        for(int l = 0; l < m_levels; ++l) {
+            int tw = m_tw >> l, th = m_th >> l;
+            for(size_t t = 0; t < m_no_textures; ++t) {
+                const uint32_t *src = &m_pixels[m_level_off[l] + tw*th*t];
+                uint32_t       *dst = &c       [m_level_off[l] + tw*th*t];
+                for(int y = 0; y < th; ++y)
+                    for(int x = 0; x < tw; ++x)
+                        dst[th*x+y] = src[tw*y+x];
+            }
+        }
+        m_columns.reset(c);
+    }
+
+    /* Row major texels of tile t_no on a level, (m_tw >> level) wide.
+     * nullptr for tiles that are not there. */
+    const uint32_t *tile(int t_no, int level) const {
+        if(t_no < 0 || (size_t)t_no >= m_no_textures)
+            return nullptr;
+        size_t td = (size_t)(m_tw >> level) * (m_th >> level);
+        return &m_pixels[m_level_off[level] + td*t_no];
+    }
+
+    /* Column x of tile t_no on a level: texel y of it is at 
+     * column[y*step]. Tiles that are not there read as a single 
+     * transparent black texel with step 0, like getColor() gives. */
+    const uint32_t *column(int t_no, int x, int level, int &step) const {
+        int tw = m_tw >> level;
+        int th = m_th >> level;
+        if(t_no < 0 || (size_t)t_no >= m_no_textures || x < 0 || x >= tw) {
+            step = 0;
+            return &m_none;
+        }
+        size_t tile = m_level_off[level] + (size_t)tw*th*t_no;
+        if(m_columns) {
+            step = 1;
+            return &m_columns[tile + th*x];
+        }
+        step = tw;
+        return &m_pixels[tile + x];
+    }
+
+    uint32_t getColor(int t_no, int x, int y, int level = 0) {
+        int tw = m_tw >> level;
+        int th = m_th >> level;
+        if(t_no < 0 || (size_t)t_no >= m_no_textures ||
+           x < 0 || x >= tw || y < 0 || y >= th) {
 #ifdef DEBUG
-            std::cout << "Addressing tilemap with wrong texture dimensions!"
-                      << t_no << " " << x << " " << y << std::endl;
+            DEBUG_LOG("Addressing tilemap with wrong texture dimensions! "
+                      "%d %d %d", t_no, x, y);
 #endif
             return 0;
         }
-        return m_pixels[ m_td*t_no + (m_tw*y+x) ];
+        return m_pixels[ m_level_off[level] + tw*th*t_no + (tw*y+x) ];
     }
 
     colorRBGA getColorRGBA(int t_no, int x, int y) {
@@ -183,9 +306,91 @@ class tileMap {
         return dst;
     }
 
+    void __classifyTiles() {
+        m_alpha.assign(m_no_textures, ALPHA_OPAQUE);
+        for(size_t t = 0; t < m_no_textures; ++t) {
+            const uint32_t *tile = &m_pixels[m_td*t];
+            ALPHA_CLASS k = ALPHA_OPAQUE;
+            for(int i = 0; i < m_td && k != ALPHA_TRANSLUCENT; ++i)
+                k = std::max(k, alpha_class(tile[i]));
+            m_alpha[t] = k;
+        }
+    }
+
+    /* Appends the mip levels of every tile to m_pixels, level by level. 
+     * A texel is the average of the 2x2 texels above it, except in keyed
+     * tiles where only the visible ones are averaged and the texel stays 
+     * visible if at least half of them are, so a tile keeps its 
+     * ALPHA_CLASS on every level. */
+    bool __buildMips() {
+        m_levels = 1;
+        while( (m_tw >> m_levels) > 0 && (m_th >> m_levels) > 0 )
+            ++m_levels;
+        m_level_off.assign(m_levels, 0);
+        size_t total = 0;
+        for(int l = 0; l < m_levels; ++l) {
+            m_level_off[l] = total;
+            total += (size_t)(m_tw >> l) * (m_th >> l) * m_no_textures;
+        }
+        uint32_t *p = reinterpret_cast<uint32_t*>(
+            realloc(m_pixels.get(), total * sizeof(uint32_t)) );
+        if(!p)
+            return false;
+        m_pixels.release();
+        m_pixels.reset(p);
+
+        for(int l = 1; l < m_levels; ++l) {
+            int stw = m_tw >> (l-1), sth = m_th >> (l-1);
+            int dtw = m_tw >> l,     dth = m_th >> l;
+            for(size_t t = 0; t < m_no_textures; ++t) {
+                const uint32_t *src = &p[m_level_off[l-1] + stw*sth*t];
+                uint32_t       *dst = &p[m_level_off[l]   + dtw*dth*t];
+                bool keyed = m_alpha[t] == ALPHA_KEYED;
+                for(int y = 0; y < dth; ++y)
+                    for(int x = 0; x < dtw; ++x) {
+                        const uint32_t q[4] = {
+                            src[stw*(2*y)   + 2*x], src[stw*(2*y)   + 2*x+1],
+                            src[stw*(2*y+1) + 2*x], src[stw*(2*y+1) + 2*x+1],
+                        };
+                        dst[dtw*y+x] = keyed ? __averageKeyed(q) 
+                                             : __average(q, 4);
+                    }
+            }
+        }
+        return true;
+    }
+
+    static uint32_t __average(const uint32_t *q, int n) {
+        uint32_t c = 0;
+        for(int shift = 0; shift < 32; shift += 8) {
+            uint32_t sum = n/2;
+            for(int i = 0; i < n; ++i)
+                sum += (q[i] >> shift) & 0xFF;
+            c |= (sum / n) << shift;
+        }
+        return c;
+    }
+
+    uint32_t __averageKeyed(const uint32_t (&q)[4]) const {
+        uint32_t visible[4];
+        int n = 0;
+        for(uint32_t c : q)
+            if(c & A_mask)
+                visible[n++] = c;
+        if(n < 2)
+            return 0;
+        return (__average(visible, n) & ~A_mask) | A_mask;
+    }
+
     //TILEMAP_PTR m_repr {nullptr, SDL_FreeSurface};
     size_t m_no_textures = 0;
+    int    m_levels      = 1;
+    bool   m_mipmaps     = true;
+    std::vector<size_t> m_level_off { 0 };
+    std::vector<ALPHA_CLASS> m_alpha;
     std::unique_ptr<uint32_t[], void(*)(void*)>m_pixels {nullptr, free};
+    std::unique_ptr<uint32_t[], void(*)(void*)>m_columns {nullptr, free};
+    const uint32_t m_none = 0;
 
     uint32_t R_mask;
     uint32_t G_mask;